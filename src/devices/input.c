@@ -41,6 +41,26 @@ input_getc (void)
   return key;
 }
 
+/* Retrieves a key from the input buffer into *KEY without
+   waiting.  Returns false if the buffer is empty. */
+bool
+input_try_getc (uint8_t *key)
+{
+  enum intr_level old_level;
+  bool success = false;
+
+  old_level = intr_disable ();
+  if (!intq_empty (&buffer))
+    {
+      *key = intq_getc (&buffer);
+      serial_notify ();
+      success = true;
+    }
+  intr_set_level (old_level);
+
+  return success;
+}
+
 /* Returns true if the input buffer is full,
    false otherwise.
    Interrupts must be off. */
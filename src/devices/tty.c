@@ -0,0 +1,253 @@
+#include "devices/tty.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/input.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+
+/* Control characters handled in canonical mode. */
+#define CTRL(C) ((C) - 'A' + 1)
+#define CHAR_EOF CTRL ('D')     /* Ends input. */
+#define CHAR_KILL CTRL ('U')    /* Erases the line being edited. */
+#define CHAR_ERASE '\b'         /* Erases one character. */
+#define CHAR_DEL 0x7f           /* Erases one character too. */
+
+/* Line discipline for the console, which reads keys from the
+   keyboard and serial port through devices/input.c.
+
+   BUF holds LEN bytes of input.  In canonical mode the first
+   READY of them form complete lines that tty_read() may return;
+   the rest make up the line still being edited. */
+struct tty
+  {
+    struct lock lock;           /* Serializes readers. */
+    struct lock mode_lock;      /* Protects MODE, never held while
+                                   waiting for input. */
+    struct tty_mode mode;       /* Current mode. */
+    uint8_t buf[TTY_BUF_SIZE];  /* Line buffer. */
+    size_t len;                 /* Bytes in BUF. */
+    size_t ready;               /* Bytes in BUF that may be read. */
+    bool eof;                   /* End of input pending after READY. */
+  };
+
+/* The console terminal. */
+static struct tty console_tty;
+
+static void receive (struct tty *, uint8_t key);
+static bool erase (struct tty *);
+static void echo (struct tty *, const char *, size_t);
+static size_t take (struct tty *, uint8_t *buffer, size_t size);
+static bool getc_timeout (uint8_t *key, int64_t ticks);
+static struct tty_mode get_mode (struct tty *);
+
+/* Initializes the console terminal in canonical mode with echo,
+   like a Unix terminal. */
+void
+tty_init (void)
+{
+  struct tty *tty = &console_tty;
+
+  lock_init (&tty->lock);
+  lock_init (&tty->mode_lock);
+  tty->mode.canonical = true;
+  tty->mode.echo = true;
+  tty->mode.vmin = 1;
+  tty->mode.vtime = 0;
+  tty->len = tty->ready = 0;
+  tty->eof = false;
+}
+
+/* Reads up to SIZE bytes of console input into BUFFER and
+   returns the number of bytes read.
+
+   In canonical mode, waits for a complete line and returns as
+   much of it as fits, including its new-line; the rest is
+   returned by later reads.  Returns 0 at end of input (Ctrl+D on
+   an empty line).
+
+   Otherwise, returns input as it arrives, as governed by VMIN
+   and VTIME: wait for VMIN bytes with no time limit if VTIME is
+   0; wait at most VTIME tenths of a second for the first byte if
+   VMIN is 0; otherwise wait for the first byte, then for VMIN
+   bytes as long as they arrive within VTIME of each other.
+   Anything already buffered is returned with them.
+
+   The read follows the mode in effect when it began; a mode
+   change takes effect with the next read. */
+size_t
+tty_read (void *buffer_, size_t size)
+{
+  struct tty *tty = &console_tty;
+  uint8_t *buffer = buffer_;
+  struct tty_mode mode;
+  size_t cnt;
+
+  lock_acquire (&tty->lock);
+  mode = get_mode (tty);
+  if (mode.canonical)
+    {
+      while (tty->ready == 0 && !tty->eof)
+        receive (tty, input_getc ());
+      if (tty->ready == 0)
+        tty->eof = false;
+      cnt = take (tty, buffer, size);
+    }
+  else
+    {
+      int64_t timeout = (int64_t) mode.vtime * TIMER_FREQ / 10;
+      size_t want = mode.vmin < size ? mode.vmin : size;
+      uint8_t key;
+
+      /* Whatever canonical mode left behind comes first. */
+      tty->ready = tty->len;
+      cnt = take (tty, buffer, size);
+
+      while (cnt < size)
+        {
+          bool got_key = true;
+
+          if (cnt < want && (timeout == 0 || cnt == 0))
+            key = input_getc ();
+          else if (cnt < want || (cnt == 0 && timeout > 0))
+            got_key = getc_timeout (&key, timeout);
+          else
+            {
+              /* Satisfied: only take what is already here. */
+              got_key = getc_timeout (&key, 0);
+            }
+          if (!got_key)
+            break;
+
+          echo (tty, (const char *) &key, 1);
+          buffer[cnt++] = key;
+        }
+    }
+  lock_release (&tty->lock);
+
+  return cnt;
+}
+
+/* Stores the console terminal's mode in *MODE.  Does not wait
+   for a read in progress. */
+void
+tty_get_mode (struct tty_mode *mode)
+{
+  *mode = get_mode (&console_tty);
+}
+
+/* Sets the console terminal's mode to *MODE.  Does not wait for
+   a read in progress, which finishes in the old mode.  Leaving
+   canonical mode makes a partly edited line readable to the next
+   read. */
+void
+tty_set_mode (const struct tty_mode *mode)
+{
+  lock_acquire (&console_tty.mode_lock);
+  console_tty.mode = *mode;
+  lock_release (&console_tty.mode_lock);
+}
+
+/* Returns a copy of TTY's mode. */
+static struct tty_mode
+get_mode (struct tty *tty)
+{
+  struct tty_mode mode;
+
+  lock_acquire (&tty->mode_lock);
+  mode = tty->mode;
+  lock_release (&tty->mode_lock);
+  return mode;
+}
+
+/* Applies KEY to TTY's line buffer in canonical mode. */
+static void
+receive (struct tty *tty, uint8_t key)
+{
+  switch (key)
+    {
+    case '\r':
+    case '\n':
+      tty->buf[tty->len++] = '\n';
+      tty->ready = tty->len;
+      echo (tty, "\n", 1);
+      break;
+
+    case CHAR_ERASE:
+    case CHAR_DEL:
+      erase (tty);
+      break;
+
+    case CHAR_KILL:
+      while (erase (tty))
+        continue;
+      break;
+
+    case CHAR_EOF:
+      /* Makes the line so far readable without a new-line, or
+         signals end of input if it is empty. */
+      if (tty->len == tty->ready)
+        tty->eof = true;
+      tty->ready = tty->len;
+      break;
+
+    default:
+      /* Keep the last byte free for the new-line. */
+      if (tty->len < TTY_BUF_SIZE - 1)
+        {
+          tty->buf[tty->len++] = key;
+          echo (tty, (const char *) &key, 1);
+        }
+      break;
+    }
+}
+
+/* Removes the last character of the line being edited in TTY,
+   also from the screen.  Returns false if the line is empty. */
+static bool
+erase (struct tty *tty)
+{
+  if (tty->len == tty->ready)
+    return false;
+  tty->len--;
+  echo (tty, "\b \b", 3);
+  return true;
+}
+
+/* Writes the SIZE bytes at S to the console if TTY echoes. */
+static void
+echo (struct tty *tty, const char *s, size_t size)
+{
+  if (get_mode (tty).echo)
+    putbuf (s, size);
+}
+
+/* Moves up to SIZE of TTY's ready bytes into BUFFER and returns
+   the number moved. */
+static size_t
+take (struct tty *tty, uint8_t *buffer, size_t size)
+{
+  size_t cnt = tty->ready < size ? tty->ready : size;
+
+  memcpy (buffer, tty->buf, cnt);
+  memmove (tty->buf, tty->buf + cnt, tty->len - cnt);
+  tty->len -= cnt;
+  tty->ready -= cnt;
+  return cnt;
+}
+
+/* Waits up to TICKS timer ticks for a key and stores it in *KEY.
+   Returns false if none arrived in time. */
+static bool
+getc_timeout (uint8_t *key, int64_t ticks)
+{
+  int64_t start = timer_ticks ();
+
+  while (!input_try_getc (key))
+    {
+      if (timer_elapsed (start) >= ticks)
+        return false;
+      timer_sleep (1);
+    }
+  return true;
+}
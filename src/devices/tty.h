@@ -0,0 +1,27 @@
+#ifndef DEVICES_TTY_H
+#define DEVICES_TTY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* How the console terminal turns keys into input, after POSIX
+   termios. */
+struct tty_mode
+  {
+    bool canonical;     /* Deliver whole edited lines? */
+    bool echo;          /* Echo keys to the console? */
+    uint8_t vmin;       /* Non-canonical: bytes to wait for. */
+    uint8_t vtime;      /* Non-canonical: timeout, in 1/10 s. */
+  };
+
+/* Size of the line buffer.  A line longer than this, less one
+   byte for its new-line, is cut short. */
+#define TTY_BUF_SIZE 256
+
+void tty_init (void);
+size_t tty_read (void *buffer, size_t size);
+void tty_get_mode (struct tty_mode *);
+void tty_set_mode (const struct tty_mode *);
+
+#endif /* devices/tty.h */
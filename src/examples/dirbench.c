@@ -0,0 +1,96 @@
+/* dirbench.c
+
+   Creates COUNT empty files in the current directory, opens each
+   one, and removes them all again, then prints the average number
+   of CPU cycles each step took per file.  COUNT defaults to 1000.
+
+   Run it with 1000 and then 10000 to see how the cost of a
+   directory operation grows with the size of the directory.  The
+   file system disk needs room for COUNT inodes. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+/* Returns the CPU's time-stamp counter, which counts cycles. */
+static inline uint64_t
+read_tsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Stores the name of file I in NAME. */
+static void
+file_name (char name[16], int i)
+{
+  snprintf (name, 16, "bench%d", i);
+}
+
+/* Prints the cycles per file taken by STEP on COUNT files since
+   START. */
+static void
+report (const char *step, uint64_t start, int count)
+{
+  printf ("%s: %llu cycles per file\n",
+          step, (read_tsc () - start) / count);
+}
+
+int
+main (int argc, char *argv[])
+{
+  char name[16];
+  uint64_t start;
+  int count = argc > 1 ? atoi (argv[1]) : 1000;
+  int i;
+
+  if (count <= 0)
+    {
+      printf ("usage: %s [COUNT]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  start = read_tsc ();
+  for (i = 0; i < count; i++)
+    {
+      file_name (name, i);
+      if (!create (name, 0))
+        {
+          printf ("%s: create failed\n", name);
+          return EXIT_FAILURE;
+        }
+    }
+  report ("create", start, count);
+
+  start = read_tsc ();
+  for (i = 0; i < count; i++)
+    {
+      int fd;
+
+      file_name (name, i);
+      fd = open (name);
+      if (fd < 0)
+        {
+          printf ("%s: open failed\n", name);
+          return EXIT_FAILURE;
+        }
+      close (fd);
+    }
+  report ("open", start, count);
+
+  start = read_tsc ();
+  for (i = 0; i < count; i++)
+    {
+      file_name (name, i);
+      if (!remove (name))
+        {
+          printf ("%s: remove failed\n", name);
+          return EXIT_FAILURE;
+        }
+    }
+  report ("remove", start, count);
+
+  return EXIT_SUCCESS;
+}
@@ -4,7 +4,6 @@
 #include <syscall.h>
 
 static void read_line (char line[], size_t);
-static bool backspace (char **pos, char line[]);
 
 int
 main (void)
@@ -45,60 +44,25 @@ main (void)
 }
 
 /* Reads a line of input from the user into LINE, which has room
-   for SIZE bytes.  Handles backspace and Ctrl+U in the ways
-   expected by Unix users.  On return, LINE will always be
-   null-terminated and will not end in a new-line character. */
+   for SIZE bytes.  The console's line discipline takes care of
+   echo, backspace and Ctrl+U, so a single read returns the whole
+   line.  On return, LINE will always be null-terminated and will
+   not end in a new-line character.  Input that does not fit is
+   discarded.  A line cut short by Ctrl+D is kept as is. */
 static void
 read_line (char line[], size_t size) 
 {
-  char *pos = line;
-  for (;;)
-    {
-      char c;
-      read (STDIN_FILENO, &c, 1);
-
-      switch (c) 
-        {
-        case '\r':
-          *pos = '\0';
-          putchar ('\n');
-          return;
-
-        case '\b':
-          backspace (&pos, line);
-          break;
-
-        case ('U' - 'A') + 1:       /* Ctrl+U. */
-          while (backspace (&pos, line))
-            continue;
-          break;
+  int cnt = read (STDIN_FILENO, line, size - 1);
 
-        default:
-          /* Add character to line. */
-          if (pos < line + size - 1) 
-            {
-              putchar (c);
-              *pos++ = c;
-            }
-          break;
-        }
-    }
-}
-
-/* If *POS is past the beginning of LINE, backs up one character
-   position.  Returns true if successful, false if nothing was
-   done. */
-static bool
-backspace (char **pos, char line[]) 
-{
-  if (*pos > line)
+  if (cnt < 0)
+    cnt = 0;
+  line[cnt] = '\0';
+  if (cnt > 0 && line[cnt - 1] == '\n')
+    line[cnt - 1] = '\0';
+  else if (cnt == (int) size - 1)
     {
-      /* Back up cursor, overwrite character, back up
-         again. */
-      printf ("\b \b");
-      (*pos)--;
-      return true;
+      char c;
+      while (read (STDIN_FILENO, &c, 1) == 1 && c != '\n')
+        continue;
     }
-  else
-    return false;
 }
@@ -0,0 +1,401 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of sectors held in the cache. */
+#define CACHE_SIZE 64
+
+/* Timer ticks between passes of the write-behind thread. */
+#define WRITE_BEHIND_TICKS TIMER_FREQ
+
+/* Most sectors waiting for the read-ahead thread. */
+#define READ_AHEAD_QUEUE 32
+
+/* A cached sector of fs_device. */
+struct cache_entry
+  {
+    /* Protected by cache_lock.  VALID and SECTOR also change only
+       while LOCK is held, so LOCK alone suffices to read them. */
+    bool valid;                         /* Does this entry hold a sector? */
+    block_sector_t sector;              /* Sector held, if valid. */
+    bool accessed;                      /* Used since the clock hand passed? */
+
+    /* Protected by LOCK. */
+    struct lock lock;                   /* Held while DATA is in use. */
+    bool dirty;                         /* Changed since read or written? */
+    bool pinned;                        /* Kept unwritten until unpinned? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Protects the mapping from sectors to entries, the accessed
+   bits, the clock hand and the statistics.  Never waited for
+   while an entry's lock is held. */
+static struct lock cache_lock;
+static size_t clock_hand;
+
+/* Sectors to be read ahead, a ring buffer protected by
+   read_ahead_lock.  READ_AHEAD_COND is signaled when one is
+   added. */
+static block_sector_t read_ahead_queue[READ_AHEAD_QUEUE];
+static size_t read_ahead_head, read_ahead_cnt;
+static struct lock read_ahead_lock;
+static struct condition read_ahead_cond;
+
+/* Statistics.  WRITE_BACK_CNT and READ_AHEAD_DONE_CNT are updated
+   without cache_lock and may undercount slightly. */
+static unsigned long long hit_cnt;        /* Lookups found in the cache. */
+static unsigned long long miss_cnt;       /* Lookups that were not. */
+static unsigned long long write_back_cnt; /* Dirty sectors written out. */
+static unsigned long long read_ahead_done_cnt; /* Sectors read ahead. */
+
+static thread_func write_behind NO_RETURN;
+static thread_func read_ahead NO_RETURN;
+
+/* Initializes the buffer cache and starts its write-behind and
+   read-ahead threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      cache[i].valid = false;
+      lock_init (&cache[i].lock);
+    }
+  lock_init (&read_ahead_lock);
+  cond_init (&read_ahead_cond);
+  thread_create ("write-behind", PRI_DEFAULT, write_behind, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead, NULL);
+}
+
+/* Writes E's data back to disk if it is dirty and not pinned.
+   E's lock must be held. */
+static void
+write_back (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (e->dirty && !e->pinned)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      write_back_cnt++;
+    }
+}
+
+/* Advances the clock hand to an unlocked, unpinned entry that has
+   not been used since the hand last passed it, locks it and
+   returns it.  Returns a null pointer if every entry is busy.
+   cache_lock must be held. */
+static struct cache_entry *
+pick_victim (void)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (e->valid && e->accessed)
+        e->accessed = false;
+      else if (lock_try_acquire (&e->lock))
+        {
+          if (!e->valid || !e->pinned)
+            return e;
+          lock_release (&e->lock);
+        }
+    }
+  return NULL;
+}
+
+/* Returns true if every entry holds a pinned sector, so that none
+   can be evicted before the running journal transaction commits.
+   cache_lock must be held. */
+static bool
+all_pinned (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      bool pinned;
+
+      if (!lock_try_acquire (&e->lock))
+        return false;
+      pinned = e->valid && e->pinned;
+      lock_release (&e->lock);
+      if (!pinned)
+        return false;
+    }
+  return true;
+}
+
+/* Returns the locked cache entry for SECTOR, bringing it into the
+   cache if necessary.  If FILL is false, the caller is going to
+   overwrite the whole sector, so it is not read from disk. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool fill)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+      size_t i;
+
+      lock_acquire (&cache_lock);
+      for (i = 0; i < CACHE_SIZE; i++)
+        {
+          e = &cache[i];
+          if (e->valid && e->sector == sector)
+            break;
+        }
+
+      if (i < CACHE_SIZE)
+        {
+          /* Hit.  The entry may be evicted while we wait for its
+             lock, so check it again afterward. */
+          e->accessed = true;
+          hit_cnt++;
+          lock_release (&cache_lock);
+
+          lock_acquire (&e->lock);
+          if (e->valid && e->sector == sector)
+            return e;
+          lock_release (&e->lock);
+          continue;
+        }
+
+      e = pick_victim ();
+      if (e == NULL)
+        {
+          /* All entries are in use.  Let their holders finish,
+             unless all of them are pinned: only a commit unpins
+             them, and it may be waiting for our own operation to
+             end.  The journal limits the pinned sectors to fewer
+             than CACHE_SIZE, so this is a bug. */
+          if (all_pinned ())
+            PANIC ("buffer cache full of pinned sectors");
+          lock_release (&cache_lock);
+          thread_yield ();
+          continue;
+        }
+
+      if (e->valid && e->dirty)
+        {
+          /* Write the victim back under its old identity, so that
+             no one reads a stale copy from disk meanwhile, then
+             look again: our sector may have come in. */
+          lock_release (&cache_lock);
+          write_back (e);
+          lock_release (&e->lock);
+          continue;
+        }
+
+      /* Take over the victim.  Anyone who finds it under its new
+         identity waits on its lock until it has been filled. */
+      e->valid = true;
+      e->sector = sector;
+      e->accessed = true;
+      e->dirty = false;
+      e->pinned = false;
+      miss_cnt++;
+      lock_release (&cache_lock);
+
+      if (fill)
+        block_read (fs_device, sector, e->data);
+      return e;
+    }
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte offset OFS within SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  lock_release (&e->lock);
+}
+
+/* Asks for SECTOR to be read into the cache in the background.
+   The request is dropped if too many are already waiting. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&read_ahead_lock);
+  if (read_ahead_cnt < READ_AHEAD_QUEUE)
+    {
+      read_ahead_queue[(read_ahead_head + read_ahead_cnt++)
+                       % READ_AHEAD_QUEUE] = sector;
+      cond_signal (&read_ahead_cond, &read_ahead_lock);
+    }
+  lock_release (&read_ahead_lock);
+}
+
+/* Returns true if SECTOR is in the cache. */
+static bool
+is_cached (block_sector_t sector)
+{
+  bool cached = false;
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    if (cache[i].valid && cache[i].sector == sector)
+      {
+        cached = true;
+        break;
+      }
+  lock_release (&cache_lock);
+  return cached;
+}
+
+/* Brings the sectors passed to cache_read_ahead() into the cache,
+   so that the disk works on them while their reader is busy with
+   the ones before. */
+static void
+read_ahead (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sector;
+
+      lock_acquire (&read_ahead_lock);
+      while (read_ahead_cnt == 0)
+        cond_wait (&read_ahead_cond, &read_ahead_lock);
+      sector = read_ahead_queue[read_ahead_head];
+      read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE;
+      read_ahead_cnt--;
+      lock_release (&read_ahead_lock);
+
+      if (!is_cached (sector))
+        {
+          lock_release (&cache_get (sector, true)->lock);
+          read_ahead_done_cnt++;
+        }
+    }
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR, starting at byte offset
+   OFS within the sector.  The data reaches the disk when the
+   write-behind thread next runs, when the sector is evicted, or at
+   cache_flush(). */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  lock_release (&e->lock);
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR, starting at byte offset
+   OFS within the sector, as cache_write_at() does, and pins the
+   sector: it stays in the cache and is not written to disk until
+   cache_unpin(). */
+void
+cache_write_pinned (block_sector_t sector, const void *buffer,
+                    int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  e->pinned = true;
+  lock_release (&e->lock);
+}
+
+/* Unpins SECTOR, which must be pinned, so that it is written to
+   disk like any other dirty sector. */
+void
+cache_unpin (block_sector_t sector)
+{
+  struct cache_entry *e = cache_get (sector, true);
+
+  ASSERT (e->pinned);
+  e->pinned = false;
+  lock_release (&e->lock);
+}
+
+/* Writes every dirty, unpinned cached sector to disk. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      lock_acquire (&e->lock);
+      if (e->valid)
+        write_back (e);
+      lock_release (&e->lock);
+    }
+}
+
+/* Periodically writes dirty sectors to disk, so that little is
+   lost if the machine stops without filesys_done().  The running
+   journal transaction, which takes in the free map's pending
+   changes, is committed first, so that its sectors reach the disk
+   in the same pass. */
+static void
+write_behind (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (WRITE_BEHIND_TICKS);
+      journal_commit ();
+      cache_flush ();
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  unsigned long long lookup_cnt = hit_cnt + miss_cnt;
+
+  printf ("Buffer cache: %llu hits, %llu misses (%llu%% hit rate), "
+          "%llu write-backs, %llu read-aheads\n",
+          hit_cnt, miss_cnt,
+          lookup_cnt > 0 ? hit_cnt * 100 / lookup_cnt : 0,
+          write_back_cnt, read_ahead_done_cnt);
+}
@@ -0,0 +1,227 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Most entries held in the dentry cache. */
+#define DCACHE_SIZE 256
+
+/* A cached directory entry: the result of looking up NAME in the
+   directory whose inode is in sector DIR.
+
+   A negative entry records that the directory has no entry by
+   that name, so that repeated lookups of missing names, such as
+   the check that filesys_create() makes, are answered without
+   reading the directory either. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru_list. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    bool found;                         /* Is NAME in DIR? */
+    block_sector_t inode_sector;        /* NAME's inode, if FOUND. */
+  };
+
+/* Entries by DIR and NAME. */
+static struct hash dentries;
+
+/* Entries, most recently used first. */
+static struct list lru_list;
+
+/* Protects everything here.  Callers hold the directory's lock
+   from inode_lock_dir() across a lookup that misses and the
+   dcache_insert() of its result, so that entries do not go stale
+   between the two. */
+static struct lock dcache_lock;
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* Lookups that found an entry. */
+static unsigned long long negative_cnt; /* Of those, negative entries. */
+static unsigned long long miss_cnt;     /* Lookups that did not. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void)
+{
+  lock_init (&dcache_lock);
+  list_init (&lru_list);
+  if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("dentry cache creation failed");
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer if there is
+   none.  dcache_lock must be held. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Removes D from the cache and frees it.  dcache_lock must be
+   held. */
+static void
+discard (struct dentry *d)
+{
+  hash_delete (&dentries, &d->hash_elem);
+  list_remove (&d->lru_elem);
+  free (d);
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   Returns DCACHE_FOUND and stores the sector of NAME's inode in
+   *SECTORP if NAME is known to be in DIR, DCACHE_ABSENT if it is
+   known not to be, or DCACHE_MISS if the directory must be
+   searched. */
+enum dcache_result
+dcache_lookup (block_sector_t dir, const char *name, block_sector_t *sectorp)
+{
+  enum dcache_result result = DCACHE_MISS;
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return DCACHE_MISS;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&lru_list, &d->lru_elem);
+      if (d->found)
+        {
+          *sectorp = d->inode_sector;
+          result = DCACHE_FOUND;
+        }
+      else
+        {
+          result = DCACHE_ABSENT;
+          negative_cnt++;
+        }
+      hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+
+  return result;
+}
+
+/* Records whether NAME is FOUND in the directory whose inode is
+   in sector DIR and, if so, that its inode is in sector
+   INODE_SECTOR.  Evicts the least recently used entry if the
+   cache is full.  Nothing is recorded if memory is short. */
+void
+dcache_insert (block_sector_t dir, const char *name,
+               bool found, block_sector_t inode_sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else
+    {
+      if (hash_size (&dentries) >= DCACHE_SIZE)
+        discard (list_entry (list_back (&lru_list), struct dentry, lru_elem));
+      d = malloc (sizeof *d);
+      if (d == NULL)
+        goto done;
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->found = found;
+  d->inode_sector = inode_sector;
+  list_push_front (&lru_list, &d->lru_elem);
+
+ done:
+  lock_release (&dcache_lock);
+}
+
+/* Forgets whatever is cached about NAME in the directory whose
+   inode is in sector DIR.  Called whenever that entry is added or
+   removed. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d != NULL)
+    discard (d);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets everything cached about the directory whose inode is in
+   sector DIR, for when a new directory is created there. */
+void
+dcache_invalidate_dir (block_sector_t dir)
+{
+  struct list_elem *e;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&lru_list); e != list_end (&lru_list); )
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      e = list_next (e);
+      if (d->dir == dir)
+        discard (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Prints dentry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  unsigned long long lookup_cnt = hit_cnt + miss_cnt;
+
+  printf ("Dentry cache: %llu hits (%llu negative), %llu misses "
+          "(%llu%% hit rate)\n",
+          hit_cnt, negative_cnt, miss_cnt,
+          lookup_cnt > 0 ? hit_cnt * 100 / lookup_cnt : 0);
+}
+
+/* Returns a hash value for dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
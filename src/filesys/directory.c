@@ -1,7 +1,9 @@
 #include "filesys/directory.h"
+#include <hash.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -21,12 +23,153 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* A directory is divided into sector-sized blocks.  Block 0 is
+   the root of a tree of index blocks, each of which lists the
+   blocks below it in order of the least hash_string() of the
+   names they hold.  The leaves of the tree are blocks of
+   directory entries.  A name is found by following the index from
+   the root to the one leaf that can hold its hash, so lookups
+   read the same few blocks however large the directory is.
+
+   When a leaf fills up, it is split in two at a hash boundary, so
+   that names with equal hashes always share a leaf, and the new
+   leaf is added to its parent.  Full index blocks are split on
+   the way down, as in a B-tree, and the tree grows a level when
+   the root fills up.
+
+   A full leaf whose names all have the same hash cannot be split.
+   Further names with that hash go to a chain of overflow leaves
+   that hangs off it, which lookups of that hash follow.  A leaf
+   with a chain holds only names with the chain's hash, so that a
+   name with any other hash splits it, and the chain goes along
+   with the half that holds its hash. */
+
+/* Size of a directory block. */
+#define DIR_BLOCK_SIZE BLOCK_SECTOR_SIZE
+
+/* Levels of index blocks below the root, at most. */
+#define MAX_DEPTH 2
+
+/* Magic numbers for directory blocks. */
+#define ROOT_MAGIC 0x544f4f52           /* Root index block. */
+#define INDEX_MAGIC 0x58444e49          /* Other index block. */
+#define LEAF_MAGIC 0x4641454c           /* Leaf block. */
+
+/* Entries in a leaf or index block. */
+#define LEAF_CNT 25
+#define INDEX_CNT 60
+
+/* A leaf block, or an overflow leaf in a chain.  Must be exactly
+   DIR_BLOCK_SIZE bytes long. */
+struct dir_leaf
+  {
+    struct dir_entry entries[LEAF_CNT]; /* Directory entries. */
+    uint32_t next;                      /* Next leaf in chain, or 0. */
+    unsigned next_hash;                 /* Hash of the names in chain. */
+    uint32_t magic;                     /* LEAF_MAGIC. */
+  };
+
+/* Reference from an index block to a block below it. */
+struct index_entry
+  {
+    unsigned hash;                      /* Least hash in BLOCK. */
+    uint32_t block;                     /* Block number. */
+  };
+
+/* An index block.  Must be exactly DIR_BLOCK_SIZE bytes long. */
+struct dir_index
+  {
+    uint32_t magic;                     /* ROOT_MAGIC or INDEX_MAGIC. */
+    uint32_t depth;                     /* Root: levels below it. */
+    uint32_t block_cnt;                 /* Root: blocks in directory. */
+    uint32_t cnt;                       /* Number of entries in use. */
+    struct index_entry entries[INDEX_CNT]; /* Ordered by hash. */
+    uint8_t unused[16];                 /* Not used. */
+  };
+
+/* Scratch space for hashed_add(). */
+struct add_buffers
+  {
+    struct dir_index root;              /* Root block. */
+    struct dir_index index[2];          /* Index blocks on the way down. */
+    struct dir_index new_index;         /* Upper half of a split. */
+    struct dir_leaf leaf;               /* Leaf for the new entry. */
+    struct dir_leaf new_leaf;           /* Upper half of a split. */
+    struct dir_entry entries[LEAF_CNT + 1]; /* Entries being split. */
+    unsigned hashes[LEAF_CNT + 1];      /* Their hashes. */
+  };
+
+static bool read_block (struct inode *, uint32_t block, void *);
+static bool write_block (struct inode *, uint32_t block, const void *);
+static bool hashed_add (struct inode *, const struct dir_entry *);
+static bool is_dot_name (const char *);
+static bool read_next (struct inode *, off_t *, char name[NAME_MAX + 1]);
+
+/* Initializes ROOT and LEAF as the only blocks of an empty
+   directory. */
+static void
+init_hashed (struct dir_index *root, struct dir_leaf *leaf)
+{
+  memset (root, 0, sizeof *root);
+  root->magic = ROOT_MAGIC;
+  root->block_cnt = 2;
+  root->cnt = 1;
+  root->entries[0].hash = 0;
+  root->entries[0].block = 1;
+
+  memset (leaf, 0, sizeof *leaf);
+  leaf->magic = LEAF_MAGIC;
+}
+
+/* Stores an entry for NAME, whose inode is in sector
+   INODE_SECTOR, in slot I of LEAF. */
+static void
+add_entry (struct dir_leaf *leaf, size_t i, const char *name,
+           block_sector_t inode_sector)
+{
+  struct dir_entry *e = &leaf->entries[i];
+
+  e->inode_sector = inode_sector;
+  strlcpy (e->name, name, sizeof e->name);
+  e->in_use = true;
+}
+
+/* Makes an empty directory of the inode in SECTOR, which must
+   have just been created by inode_create() with length 0 and
+   IS_DIR true, and whose parent directory is in sector
+   PARENT_SECTOR.  The new directory holds entries "." and ".."
+   for itself and its parent, which path resolution follows like
+   any other name.
+   Returns true if successful, false on failure.  On failure, the
+   caller removes the inode, releasing anything written so far. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, block_sector_t parent_sector)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir_index *root = malloc (sizeof *root);
+  struct dir_leaf *leaf = malloc (sizeof *leaf);
+  struct inode *inode = NULL;
+  bool success = false;
+
+  ASSERT (sizeof *root == DIR_BLOCK_SIZE);
+  ASSERT (sizeof *leaf == DIR_BLOCK_SIZE);
+
+  dcache_invalidate_dir (sector);
+  if (root != NULL && leaf != NULL)
+    {
+      inode = inode_open (sector);
+      if (inode != NULL)
+        {
+          init_hashed (root, leaf);
+          add_entry (leaf, 0, ".", sector);
+          add_entry (leaf, 1, "..", parent_sector);
+          success = (write_block (inode, 0, root)
+                     && write_block (inode, 1, leaf));
+        }
+    }
+  inode_close (inode);
+  free (root);
+  free (leaf);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -83,6 +226,388 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Reads block number BLOCK of directory INODE into
+   BUFFER.  Returns true if successful, false on failure. */
+static bool
+read_block (struct inode *inode, uint32_t block, void *buffer)
+{
+  return inode_read_at (inode, buffer, DIR_BLOCK_SIZE,
+                        block * DIR_BLOCK_SIZE) == DIR_BLOCK_SIZE;
+}
+
+/* Writes BUFFER to block number BLOCK of directory INODE,
+   extending it if necessary.  Returns true if successful, false
+   on failure. */
+static bool
+write_block (struct inode *inode, uint32_t block, const void *buffer)
+{
+  return inode_write_at (inode, buffer, DIR_BLOCK_SIZE,
+                         block * DIR_BLOCK_SIZE) == DIR_BLOCK_SIZE;
+}
+
+/* Returns the position in index block X of the entry for the
+   block below it that can hold HASH. */
+static size_t
+index_search (const struct dir_index *x, unsigned hash)
+{
+  size_t lo = 0, hi = x->cnt;
+
+  /* entries[lo].hash <= HASH < entries[hi].hash. */
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (x->entries[mid].hash <= hash)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Inserts a reference to BLOCK, whose least hash is HASH, into
+   index block X at position I.  X must not be full. */
+static void
+index_insert (struct dir_index *x, size_t i, unsigned hash, uint32_t block)
+{
+  ASSERT (x->cnt < INDEX_CNT);
+  ASSERT (i <= x->cnt);
+
+  memmove (&x->entries[i + 1], &x->entries[i],
+           (x->cnt - i) * sizeof *x->entries);
+  x->entries[i].hash = hash;
+  x->entries[i].block = block;
+  x->cnt++;
+}
+
+/* Searches directory INODE for a file with the given NAME, as
+   described for lookup(). */
+static bool
+hashed_lookup (struct inode *inode, const char *name,
+               struct dir_entry *ep, off_t *ofsp)
+{
+  unsigned hash = hash_string (name);
+  struct dir_index *x;
+  struct dir_leaf *leaf;
+  uint32_t block = 0, level;
+  bool found = false;
+  size_t i;
+
+  /* X and LEAF share a buffer. */
+  x = malloc (DIR_BLOCK_SIZE);
+  leaf = (struct dir_leaf *) x;
+  if (x == NULL || !read_block (inode, 0, x))
+    goto done;
+
+  for (level = x->depth + 1; level > 0; level--)
+    {
+      block = x->entries[index_search (x, hash)].block;
+      if (!read_block (inode, block, x))
+        goto done;
+    }
+
+  for (;;)
+    {
+      for (i = 0; i < LEAF_CNT; i++)
+        if (leaf->entries[i].in_use
+            && !strcmp (name, leaf->entries[i].name))
+          {
+            if (ep != NULL)
+              *ep = leaf->entries[i];
+            if (ofsp != NULL)
+              *ofsp = block * DIR_BLOCK_SIZE + i * sizeof *leaf->entries;
+            found = true;
+            goto done;
+          }
+
+      /* Follow the chain of overflow leaves for HASH, if any. */
+      if (leaf->next == 0 || leaf->next_hash != hash)
+        break;
+      block = leaf->next;
+      if (!read_block (inode, block, leaf))
+        break;
+    }
+
+ done:
+  free (x);
+  return found;
+}
+
+/* Splits full index block CHILD, number CHILD_BLOCK, which is at
+   position I in PARENT, moving its upper half into NEW, a new
+   block allocated from ROOT.  Returns the new block's number, or
+   0 on failure. */
+static uint32_t
+split_index (struct inode *inode, struct dir_index *root,
+             struct dir_index *parent, uint32_t parent_block, size_t i,
+             struct dir_index *child, uint32_t child_block,
+             struct dir_index *new)
+{
+  size_t half = INDEX_CNT / 2;
+  uint32_t new_block = root->block_cnt++;
+
+  *new = *child;
+  new->cnt = INDEX_CNT - half;
+  memmove (new->entries, &new->entries[half],
+           new->cnt * sizeof *new->entries);
+  child->cnt = half;
+  index_insert (parent, i + 1, new->entries[0].hash, new_block);
+
+  /* Write the new block before anything that refers to it. */
+  if (!write_block (inode, new_block, new)
+      || !write_block (inode, child_block, child)
+      || !write_block (inode, parent_block, parent)
+      || (parent != root && !write_block (inode, 0, root)))
+    return 0;
+  return new_block;
+}
+
+/* Starts a chain of overflow leaves for full leaf block LEAF,
+   number LEAF_BLOCK, whose names all have the same HASH as E, and
+   stores E in it.  Returns true if successful, false on
+   failure. */
+static bool
+start_chain (struct inode *inode, struct add_buffers *b,
+             uint32_t leaf_block, unsigned hash, const struct dir_entry *e)
+{
+  uint32_t new_block = b->root.block_cnt++;
+
+  memset (&b->new_leaf, 0, sizeof b->new_leaf);
+  b->new_leaf.magic = LEAF_MAGIC;
+  b->new_leaf.entries[0] = *e;
+  b->new_leaf.next_hash = hash;
+  b->leaf.next = new_block;
+  b->leaf.next_hash = hash;
+
+  /* Write the new block before anything that refers to it. */
+  return (write_block (inode, new_block, &b->new_leaf)
+          && write_block (inode, leaf_block, &b->leaf)
+          && write_block (inode, 0, &b->root));
+}
+
+/* Stores E, whose name has the hash of the chain of overflow
+   leaves of full leaf block LEAF, in the first free slot along the
+   chain, adding a leaf to its end if there is none.  Returns true
+   if successful, false on failure. */
+static bool
+add_to_chain (struct inode *inode, struct add_buffers *b,
+              const struct dir_entry *e)
+{
+  struct dir_leaf *leaf = &b->leaf;
+  uint32_t block = 0, new_block;
+  size_t j;
+
+  while (leaf->next != 0)
+    {
+      block = leaf->next;
+      leaf = &b->new_leaf;
+      if (!read_block (inode, block, leaf))
+        return false;
+      for (j = 0; j < LEAF_CNT; j++)
+        if (!leaf->entries[j].in_use)
+          {
+            off_t ofs = block * DIR_BLOCK_SIZE + j * sizeof *e;
+            return inode_write_at (inode, e, sizeof *e, ofs) == sizeof *e;
+          }
+    }
+
+  /* The last leaf of the chain is in NEW_LEAF. */
+  new_block = b->root.block_cnt++;
+  memset (&b->leaf, 0, sizeof b->leaf);
+  b->leaf.magic = LEAF_MAGIC;
+  b->leaf.entries[0] = *e;
+  b->leaf.next_hash = b->new_leaf.next_hash;
+  b->new_leaf.next = new_block;
+
+  /* Write the new block before anything that refers to it. */
+  return (write_block (inode, new_block, &b->leaf)
+          && write_block (inode, block, &b->new_leaf)
+          && write_block (inode, 0, &b->root));
+}
+
+/* Splits leaf block LEAF, number LEAF_BLOCK, at position I in
+   PARENT, to make room for E, whose name has hash HASH, and
+   stores E in one half.  LEAF is full, or it has a chain of
+   overflow leaves for a hash other than HASH, which goes along
+   with the half that holds its names.  If LEAF's names and E's
+   all have the same hash, starts a chain for them instead.
+   Returns true if successful, false on failure. */
+static bool
+split_leaf (struct inode *inode, struct add_buffers *b,
+            struct dir_index *parent, uint32_t parent_block, size_t i,
+            uint32_t leaf_block, unsigned hash, const struct dir_entry *e)
+{
+  struct dir_entry *entries = b->entries;
+  unsigned *hashes = b->hashes;
+  uint32_t chain = b->leaf.next;
+  unsigned chain_hash = b->leaf.next_hash;
+  unsigned split_hash;
+  size_t cnt = 0;
+  size_t j, d, split;
+  uint32_t new_block;
+
+  /* Sort the entries in use and E by hash. */
+  for (j = 0; j <= LEAF_CNT; j++)
+    {
+      struct dir_entry x = j < LEAF_CNT ? b->leaf.entries[j] : *e;
+      unsigned x_hash;
+      size_t k;
+
+      if (!x.in_use)
+        continue;
+      x_hash = hash_string (x.name);
+      for (k = cnt; k > 0 && hashes[k - 1] > x_hash; k--)
+        {
+          entries[k] = entries[k - 1];
+          hashes[k] = hashes[k - 1];
+        }
+      entries[k] = x;
+      hashes[k] = x_hash;
+      cnt++;
+    }
+
+  if (chain != 0)
+    {
+      /* Every name but E's has the chain's hash, so E goes into a
+         half of its own. */
+      split = hash < chain_hash ? 1 : cnt - 1;
+      split_hash = hash < chain_hash ? chain_hash : hash;
+    }
+  else
+    {
+      /* Find the hash boundary nearest the middle. */
+      split = 0;
+      for (d = 0; d < cnt / 2 && split == 0; d++)
+        if (hashes[cnt / 2 - d - 1] != hashes[cnt / 2 - d])
+          split = cnt / 2 - d;
+        else if (cnt / 2 + d < cnt - 1
+                 && hashes[cnt / 2 + d] != hashes[cnt / 2 + d + 1])
+          split = cnt / 2 + d + 1;
+      if (split == 0)
+        return start_chain (inode, b, leaf_block, hash, e);
+      split_hash = hashes[split];
+    }
+
+  memset (b->leaf.entries, 0, sizeof b->leaf.entries);
+  memcpy (b->leaf.entries, entries, split * sizeof *entries);
+  memset (&b->new_leaf, 0, sizeof b->new_leaf);
+  b->new_leaf.magic = LEAF_MAGIC;
+  memcpy (b->new_leaf.entries, &entries[split],
+          (cnt - split) * sizeof *entries);
+  if (chain != 0 && chain_hash >= split_hash)
+    {
+      b->new_leaf.next = chain;
+      b->new_leaf.next_hash = chain_hash;
+      b->leaf.next = 0;
+      b->leaf.next_hash = 0;
+    }
+
+  new_block = b->root.block_cnt++;
+  index_insert (parent, i + 1, split_hash, new_block);
+
+  /* Write the new block before anything that refers to it. */
+  return (write_block (inode, new_block, &b->new_leaf)
+          && write_block (inode, leaf_block, &b->leaf)
+          && write_block (inode, parent_block, parent)
+          && (parent == &b->root || write_block (inode, 0, &b->root)));
+}
+
+/* Adds E to directory INODE, which must not already
+   contain an entry with its name.  Returns true if successful,
+   false on failure. */
+static bool
+hashed_add (struct inode *inode, const struct dir_entry *e)
+{
+  unsigned hash = hash_string (e->name);
+  struct add_buffers *b;
+  struct dir_index *parent;
+  uint32_t parent_block = 0, level;
+  bool success = false;
+  size_t i;
+
+  b = malloc (sizeof *b);
+  if (b == NULL || !read_block (inode, 0, &b->root))
+    goto done;
+
+  /* Keep the root from filling up by moving its entries into a
+     new index block below it. */
+  if (b->root.cnt == INDEX_CNT)
+    {
+      struct dir_index *x = &b->index[0];
+      uint32_t x_block;
+
+      if (b->root.depth == MAX_DEPTH)
+        goto done;
+      x_block = b->root.block_cnt++;
+      *x = b->root;
+      x->magic = INDEX_MAGIC;
+      x->depth = x->block_cnt = 0;
+      b->root.depth++;
+      b->root.cnt = 1;
+      b->root.entries[0].block = x_block;
+      if (!write_block (inode, x_block, x) || !write_block (inode, 0, &b->root))
+        goto done;
+    }
+
+  /* Walk down to the leaf for HASH, splitting full index blocks
+     so that there is room for a reference to a new block in the
+     leaf's parent. */
+  parent = &b->root;
+  for (level = 0; level < b->root.depth; level++)
+    {
+      struct dir_index *child = parent == &b->index[0] ? &b->index[1]
+                                                        : &b->index[0];
+      uint32_t child_block;
+
+      i = index_search (parent, hash);
+      child_block = parent->entries[i].block;
+      if (!read_block (inode, child_block, child))
+        goto done;
+      if (child->cnt == INDEX_CNT)
+        {
+          uint32_t new_block = split_index (inode, &b->root,
+                                            parent, parent_block, i,
+                                            child, child_block,
+                                            &b->new_index);
+          if (new_block == 0)
+            goto done;
+          if (hash >= b->new_index.entries[0].hash)
+            {
+              *child = b->new_index;
+              child_block = new_block;
+            }
+        }
+      parent = child;
+      parent_block = child_block;
+    }
+
+  i = index_search (parent, hash);
+  if (read_block (inode, parent->entries[i].block, &b->leaf))
+    {
+      uint32_t leaf_block = parent->entries[i].block;
+      bool chained = b->leaf.next != 0;
+      size_t j;
+
+      if (!chained || b->leaf.next_hash == hash)
+        for (j = 0; j < LEAF_CNT; j++)
+          if (!b->leaf.entries[j].in_use)
+            {
+              off_t ofs = leaf_block * DIR_BLOCK_SIZE + j * sizeof *e;
+              success = (inode_write_at (inode, e, sizeof *e, ofs)
+                         == sizeof *e);
+              goto done;
+            }
+      if (chained && b->leaf.next_hash == hash)
+        success = add_to_chain (inode, b, e);
+      else
+        success = split_leaf (inode, b, parent, parent_block, i,
+                              leaf_block, hash, e);
+    }
+
+ done:
+  free (b);
+  return success;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -92,23 +617,10 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
-  
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  return hashed_lookup (dir->inode, name, ep, ofsp);
 }
 
 /* Searches DIR for a file with the given NAME
@@ -119,15 +631,26 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector, sector = 0;
+  enum dcache_result cached;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  dir_sector = inode_get_inumber (dir->inode);
+  inode_lock_dir (dir->inode);
+  cached = dcache_lookup (dir_sector, name, &sector);
+  if (cached == DCACHE_MISS)
+    {
+      bool found = lookup (dir, name, &e, NULL);
+      if (found)
+        sector = e.inode_sector;
+      dcache_insert (dir_sector, name, found, sector);
+      cached = found ? DCACHE_FOUND : DCACHE_ABSENT;
+    }
+  *inode = cached == DCACHE_FOUND ? inode_open (sector) : NULL;
+  inode_unlock_dir (dir->inode);
 
   return *inode != NULL;
 }
@@ -136,13 +659,14 @@ dir_lookup (const struct dir *dir, const char *name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), DIR has been
+   removed, or a disk or memory error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  block_sector_t dir_sector, sector;
+  enum dcache_result cached;
   struct dir_entry e;
-  off_t ofs;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,46 +676,53 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  dir_sector = inode_get_inumber (dir->inode);
+  inode_lock_dir (dir->inode);
+
+  /* A removed directory stays empty. */
+  if (inode_is_removed (dir->inode))
+    goto done;
+
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  cached = dcache_lookup (dir_sector, name, &sector);
+  if (cached == DCACHE_FOUND
+      || (cached == DCACHE_MISS && lookup (dir, name, NULL, NULL)))
     goto done;
+  dcache_invalidate (dir_sector, name);
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  success = hashed_add (dir->inode, &e);
 
  done:
+  inode_unlock_dir (dir->inode);
   return success;
 }
 
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs if
+   there is no file with the given NAME or NAME is a directory
+   that is not empty or is open elsewhere, for instance as some
+   process's working directory.  "." and ".." cannot be
+   removed. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  bool locked = false;
   bool success = false;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (is_dot_name (name))
+    return false;
+
+  inode_lock_dir (dir->inode);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -201,36 +732,105 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* A directory must be empty and open only here.  Its own lock,
+     held until it is marked removed, keeps entries from being
+     added meanwhile, and a removed directory takes none. */
+  if (inode_is_dir (inode))
+    {
+      char entry[NAME_MAX + 1];
+      off_t pos = 0;
+
+      inode_lock_dir (inode);
+      locked = true;
+      if (inode_open_cnt (inode) > 1 || read_next (inode, &pos, entry))
+        goto done;
+    }
+
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  if (locked)
+    inode_unlock_dir (inode);
+  inode_unlock_dir (dir->inode);
   inode_close (inode);
   return success;
 }
 
-/* Reads the next directory entry in DIR and stores the name in
-   NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
-bool
-dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+/* Returns true if NAME is "." or "..", which every directory
+   holds and readdir does not report. */
+static bool
+is_dot_name (const char *name)
+{
+  return !strcmp (name, ".") || !strcmp (name, "..");
+}
+
+/* Reads the next entry, other than "." and "..", in directory
+   INODE at or after byte offset *POSP, stores its name in NAME,
+   and advances *POSP past it.  Returns true if successful, false
+   if the directory contains no more entries.  The directory's
+   lock must be held. */
+static bool
+read_next (struct inode *inode, off_t *posp, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  /* Visit the entries of each leaf block, overflow leaves
+     included, in turn, skipping index blocks. */
+  while (*posp < inode_length (inode))
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      off_t block_ofs = *posp / DIR_BLOCK_SIZE * DIR_BLOCK_SIZE;
+      size_t slot = (*posp - block_ofs) / sizeof e;
+      uint32_t magic;
+
+      if (slot >= LEAF_CNT
+          || (inode_read_at (inode, &magic, sizeof magic,
+                             block_ofs + offsetof (struct dir_leaf, magic))
+              != sizeof magic)
+          || magic != LEAF_MAGIC)
+        {
+          *posp = block_ofs + DIR_BLOCK_SIZE;
+          continue;
+        }
+      if (inode_read_at (inode, &e, sizeof e, *posp) != sizeof e)
+        return false;
+      *posp += sizeof e;
+      if (e.in_use && !is_dot_name (e.name))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
           return true;
-        } 
+        }
     }
   return false;
 }
+
+/* Reads the next directory entry in DIR and stores the name in
+   NAME.  Returns true if successful, false if the directory
+   contains no more entries. */
+bool
+dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+{
+  return dir_readdir_at (dir->inode, &dir->pos, name);
+}
+
+/* Reads the next directory entry in directory INODE at or after
+   byte offset *POSP, as dir_readdir() does for a directory whose
+   position is *POSP.  For reading a directory through a file
+   opened on it. */
+bool
+dir_readdir_at (struct inode *inode, off_t *posp, char name[NAME_MAX + 1])
+{
+  bool found;
+
+  inode_lock_dir (inode);
+  found = read_next (inode, posp, name);
+  inode_unlock_dir (inode);
+  return found;
+}
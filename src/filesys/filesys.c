@@ -2,10 +2,14 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -21,12 +25,16 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
-  inode_init ();
   free_map_init ();
+  cache_init ();
+  dcache_init ();
+  inode_init ();
+  journal_init ();
 
   if (format) 
     do_format ();
 
+  journal_open ();
   free_map_open ();
 }
 
@@ -35,30 +43,208 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  journal_close ();
   free_map_close ();
+  cache_flush ();
+}
+
+/* Prints file system statistics. */
+void
+filesys_print_stats (void)
+{
+  cache_print_stats ();
+  dcache_print_stats ();
+  free_map_print_stats ();
+  journal_print_stats ();
 }
 
+/* Extracts a file name part from *SRCP into PART, and updates
+   *SRCP so that the next call will return the next file name
+   part.  Returns 1 if successful, 0 at end of string, -1 for a
+   too-long file name part. */
+static int
+get_next_part (char part[NAME_MAX + 1], const char **srcp)
+{
+  const char *src = *srcp;
+  char *dst = part;
+
+  /* Skip leading slashes.  If it's all slashes, we're done. */
+  while (*src == '/')
+    src++;
+  if (*src == '\0')
+    return 0;
+
+  /* Copy up to NAME_MAX characters from SRC to DST.  Add null
+     terminator. */
+  while (*src != '/' && *src != '\0') 
+    {
+      if (dst < part + NAME_MAX)
+        *dst++ = *src;
+      else
+        return -1;
+      src++; 
+    }
+  *dst = '\0';
+
+  /* Advance source pointer. */
+  *srcp = src;
+  return 1;
+}
+
+/* Opens the directory that holds the file named by PATH and
+   copies the last component of PATH into NAME.  A path that
+   begins with "/" is resolved from the root directory, any other
+   from the current thread's working directory.  A path that
+   names the root directory has last component ".".
+   Returns the directory, which the caller must close, or a null
+   pointer if PATH is empty or invalid or a directory along it
+   does not exist. */
+static struct dir *
+open_parent (const char *path, char name[NAME_MAX + 1])
+{
+  struct dir *cwd = thread_current ()->cwd;
+  struct dir *dir;
+  char next[NAME_MAX + 1];
+  int result;
+
+  if (*path == '\0')
+    return NULL;
+  dir = *path == '/' || cwd == NULL ? dir_open_root () : dir_reopen (cwd);
+
+  strlcpy (name, ".", NAME_MAX + 1);
+  result = get_next_part (name, &path);
+  while (result > 0 && dir != NULL)
+    {
+      struct inode *inode;
+
+      result = get_next_part (next, &path);
+      if (result == 0)
+        break;
+
+      /* NAME is a directory along the way. */
+      if (!dir_lookup (dir, name, &inode) || !inode_is_dir (inode))
+        {
+          inode_close (inode);
+          result = -1;
+          break;
+        }
+      dir_close (dir);
+      dir = dir_open (inode);
+      strlcpy (name, next, NAME_MAX + 1);
+    }
+
+  if (result < 0)
+    {
+      dir_close (dir);
+      return NULL;
+    }
+  return dir;
+}
+
+/* Journal credits of creating a file or directory.  Making a
+   directory writes its inode and two directory blocks, and adding
+   its entry to the parent can split index blocks on the way down:
+   up to seven directory blocks, four of them new, the parent's
+   inode and three index sectors.  The free map changes for the new
+   inode, for the file's data or the directory's two blocks, and
+   for the parent's new blocks and index sectors. */
+#define CREATE_BLOCKS 14
+#define CREATE_FREE_MAP (INODE_CREATE_FREE_MAP + 10)
+
+/* Journal credits of removing a file or directory, which erases
+   its entry in one directory block and may release its sectors
+   too, restarting as often as that takes. */
+#define REMOVE_BLOCKS 1
+
+/* Releases the inode just created in SECTOR, with every sector
+   allocated for it, after its creation could not be completed. */
+static void
+discard_inode (block_sector_t sector)
+{
+  struct inode *inode = inode_open (sector);
+
+  if (inode != NULL)
+    {
+      inode_remove (inode);
+      inode_close (inode);
+    }
+  else
+    free_map_release (sector, 1);
+}
+
+/* Creates a file, or a directory if IS_DIR is true, named PATH
+   with the given INITIAL_SIZE, in one journal operation.  Returns
+   true if successful, false otherwise. */
+static bool
+try_create (const char *path, off_t initial_size, bool is_dir)
+{
+  block_sector_t inode_sector = 0;
+  char name[NAME_MAX + 1];
+  struct dir *dir;
+  bool created;
+  bool success;
+
+  journal_begin (CREATE_BLOCKS, CREATE_FREE_MAP);
+  dir = open_parent (path, name);
+  created = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && inode_create (inode_sector, is_dir ? 0 : initial_size,
+                              is_dir));
+  success = (created
+             && (!is_dir
+                 || dir_create (inode_sector,
+                                inode_get_inumber (dir_get_inode (dir))))
+             && dir_add (dir, name, inode_sector));
+  if (!success && created)
+    discard_inode (inode_sector);
+  else if (!success && inode_sector != 0)
+    free_map_release (inode_sector, 1);
+  dir_close (dir);
+  journal_end ();
+
+  return success;
+}
+
+/* Creates a file, or a directory if IS_DIR is true, named PATH
+   with the given INITIAL_SIZE.  Sectors released by the running
+   transaction become free only when it commits, so if the disk
+   seems full, commits it and tries again.  Returns true if
+   successful, false otherwise. */
+static bool
+create (const char *path, off_t initial_size, bool is_dir)
+{
+  if (try_create (path, initial_size, is_dir))
+    return true;
+  if (!free_map_has_released ())
+    return false;
+  journal_commit ();
+  return try_create (path, initial_size, is_dir);
+}
+
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
+   if a directory in NAME does not exist,
+   if the disk does not have room for INITIAL_SIZE bytes,
    or if internal memory allocation fails. */
 bool
 filesys_create (const char *name, off_t initial_size) 
 {
-  block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
-  if (!success && inode_sector != 0) 
-    free_map_release (inode_sector, 1);
-  dir_close (dir);
+  return create (name, initial_size, false);
+}
 
-  return success;
+/* Creates an empty directory named NAME.
+   Returns true if successful, false otherwise.
+   Fails if a file named NAME already exists,
+   if a directory in NAME does not exist,
+   or if internal memory allocation fails. */
+bool
+filesys_mkdir (const char *name)
+{
+  return create (name, 0, true);
 }
 
-/* Opens the file with the given NAME.
+/* Opens the file or directory with the given NAME.
    Returns the new file if successful or a null pointer
    otherwise.
    Fails if no file named NAME exists,
@@ -66,37 +252,76 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = dir_open_root ();
+  char part[NAME_MAX + 1];
+  struct dir *dir = open_parent (name, part);
   struct inode *inode = NULL;
 
   if (dir != NULL)
-    dir_lookup (dir, name, &inode);
+    dir_lookup (dir, part, &inode);
   dir_close (dir);
 
   return file_open (inode);
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file or empty directory named NAME.
    Returns true if successful, false on failure.
-   Fails if no file named NAME exists,
-   or if an internal memory allocation fails. */
+   Fails if no file named NAME exists, if NAME is a directory
+   that is not empty or is open, as a working directory for
+   instance, or if an internal memory allocation fails. */
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  char part[NAME_MAX + 1];
+  struct dir *dir;
+  bool success;
+
+  journal_begin (REMOVE_BLOCKS, INODE_RELEASE_FREE_MAP);
+  dir = open_parent (name, part);
+  success = dir != NULL && dir_remove (dir, part);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
-
+
+/* Changes the current thread's working directory to the
+   directory named NAME.  Returns true if successful, false on
+   failure. */
+bool
+filesys_chdir (const char *name)
+{
+  struct thread *t = thread_current ();
+  char part[NAME_MAX + 1];
+  struct dir *dir = open_parent (name, part);
+  struct inode *inode = NULL;
+
+  if (dir != NULL)
+    dir_lookup (dir, part, &inode);
+  dir_close (dir);
+
+  if (inode == NULL || !inode_is_dir (inode))
+    {
+      inode_close (inode);
+      return false;
+    }
+  dir = dir_open (inode);
+  if (dir == NULL)
+    return false;
+
+  dir_close (t->cwd);
+  t->cwd = dir;
+  return true;
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  journal_create ();
+  if (!inode_create (ROOT_DIR_SECTOR, 0, true)
+      || !dir_create (ROOT_DIR_SECTOR, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
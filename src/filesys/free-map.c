@@ -1,52 +1,630 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
+#include <stdio.h>
+#include <tree.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Sectors whose bits one free map file sector holds. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * CHAR_BIT)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects everything here. */
+static size_t free_cnt;              /* Number of free sectors. */
+
+/* Free sectors set aside for the holes of files, which only
+   free_map_allocate_reserved() hands out.  Stored in the free map
+   file just past the bitmap, at RESERVED_OFS, so that it stays in
+   step with the inodes that hold the reservations. */
+static uint32_t reserved_cnt;
+static off_t reserved_ofs;
+
+/* Sectors released since the last commit, one bit per sector,
+   all of them between RELEASED_LO and RELEASED_HI.  They are free
+   in free_map but not in the free extents until the transaction
+   that released them commits, so that nothing overwrites a
+   sector that the file system on disk may still be using. */
+static struct bitmap *released;
+static size_t released_cnt;
+static size_t released_lo, released_hi;
+
+/* Sectors of the free map file whose contents have changed in
+   free_map or reserved_cnt since they were last written, one bit
+   per sector.  Written out by free_map_flush(), at commit, and
+   counted against the journal operation that changed them. */
+static struct bitmap *dirty_sectors;
+static unsigned long long sector_write_cnt; /* Free map sectors written. */
+
+/* A maximal run of free sectors.
+
+   Every free sector in free_map belongs to exactly one extent,
+   and extents never touch, since adjacent ones are merged.  Each
+   extent is in two trees, one ordered by start sector, to find
+   neighbors to merge with, and one by size, to find the best fit
+   for an allocation. */
+struct free_extent
+  {
+    block_sector_t start;               /* First free sector. */
+    size_t cnt;                         /* Number of free sectors. */
+    struct tree_elem start_elem;        /* Element in by_start. */
+    struct tree_elem size_elem;         /* Element in by_size. */
+  };
+
+static struct tree by_start;         /* Free extents by START. */
+static struct tree by_size;          /* Free extents by CNT, then START. */
+
+static tree_less_func start_less, size_less;
+static void build_index (void);
+static void add_extent (block_sector_t, size_t);
+static bool take_extent (struct free_extent *, block_sector_t, size_t);
+static size_t available (void);
+static void release (block_sector_t, size_t);
+static void mark_sectors (block_sector_t, size_t, bool);
+static void mark_dirty (size_t);
+static void mark_reserved (uint32_t);
+static bool write_reserved (void);
+static struct free_extent *best_fit (size_t);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  lock_init (&free_map_lock);
+  tree_init (&by_start, start_less, NULL);
+  tree_init (&by_size, size_less, NULL);
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  released = bitmap_create (block_size (fs_device));
+  if (released == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  released_lo = bitmap_size (released);
+  reserved_ofs = bitmap_file_size (free_map);
+  dirty_sectors = bitmap_create (free_map_sectors ());
+  if (dirty_sectors == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, JOURNAL_SECTOR);
+  build_index ();
+}
+
+/* Returns the number of sectors in the free map file. */
+size_t
+free_map_sectors (void)
+{
+  return DIV_ROUND_UP (reserved_ofs + sizeof reserved_cnt, BLOCK_SECTOR_SIZE);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  Chooses the smallest free extent that
+   is large enough, lowest first among equals.  Sectors reserved
+   for holes are left alone.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available or if memory is exhausted. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  struct free_extent *e = NULL;
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (cnt <= available ())
+    e = best_fit (cnt);
+  if (e != NULL)
+    {
+      block_sector_t sector = e->start;
+      if (take_extent (e, sector, cnt))
+        {
+          mark_sectors (sector, cnt, true);
+          *sectorp = sector;
+          success = true;
+        }
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Allocates up to CNT consecutive sectors and stores the first
+   into *SECTORP.  Allocates CNT sectors as free_map_allocate()
+   would if possible, otherwise all of the largest free extent,
+   but never more than the sectors not reserved for holes.
+   Returns the number of sectors allocated, 0 if the disk is full
+   or memory is exhausted. */
+size_t
+free_map_allocate_upto (size_t cnt, block_sector_t *sectorp)
+{
+  struct free_extent *e = NULL;
+  size_t allocated = 0;
+
+  lock_acquire (&free_map_lock);
+  if (cnt > available ())
+    cnt = available ();
+  if (cnt > 0)
+    e = best_fit (cnt);
+  if (e == NULL && cnt > 0 && !tree_empty (&by_size))
+    e = tree_entry (tree_last (&by_size), struct free_extent, size_elem);
+  if (e != NULL)
+    {
+      block_sector_t sector = e->start;
+      size_t n = e->cnt < cnt ? e->cnt : cnt;
+      if (take_extent (e, sector, n))
+        {
+          mark_sectors (sector, n, true);
+          *sectorp = sector;
+          allocated = n;
+        }
+    }
+  lock_release (&free_map_lock);
+  return allocated;
+}
+
+/* Allocates the CNT sectors starting at SECTOR, for extending a
+   run of sectors that ends just before SECTOR.
+   Returns true if successful, false if any of them is in use, if
+   they would eat into the sectors reserved for holes, or if
+   memory is exhausted. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  struct free_extent key = { .start = sector }, *e = NULL;
+  struct tree_elem *elem;
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  elem = tree_upper_bound (&by_start, &key.start_elem);
+  elem = elem != NULL ? tree_prev (elem) : tree_last (&by_start);
+  if (elem != NULL)
+    e = tree_entry (elem, struct free_extent, start_elem);
+  if (e != NULL && sector + cnt <= e->start + e->cnt
+      && cnt <= available ()
+      && take_extent (e, sector, cnt))
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark_sectors (sector, cnt, true);
+      success = true;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release (&free_map_lock);
+  return success;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Releases the CNT sectors starting at SECTOR.  They become
+   available for use when the running transaction commits. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&free_map_lock);
+  release (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Releases as many of the CNT sectors starting at SECTOR as the
+   current journal operation has room to change the free map
+   for, and returns the number released.  Returns 0 only if the
+   operation needs restarting first. */
+size_t
+free_map_release_upto (block_sector_t sector, size_t cnt)
+{
+  size_t room = journal_free_map_room ();
+  size_t n = 0;
+
+  lock_acquire (&free_map_lock);
+  while (n < cnt)
+    {
+      size_t i = (sector + n) / BITS_PER_SECTOR;
+      size_t end = (i + 1) * BITS_PER_SECTOR - sector;
+
+      if (!bitmap_test (dirty_sectors, i))
+        {
+          if (room == 0)
+            break;
+          room--;
+        }
+      n = end < cnt ? end : cnt;
+    }
+  release (sector, n);
+  lock_release (&free_map_lock);
+  return n;
+}
+
+/* Returns true if sectors released since the last commit are
+   waiting for it to become available, so that an allocation that
+   failed might succeed after a commit. */
+bool
+free_map_has_released (void)
+{
+  bool has_released;
+
+  lock_acquire (&free_map_lock);
+  has_released = released_cnt > 0;
+  lock_release (&free_map_lock);
+  return has_released;
+}
+
+/* Makes the sectors released since the last call available for
+   use.  Called once the transaction that released them has
+   committed. */
+void
+free_map_reuse (void)
+{
+  size_t start = released_lo;
+
+  lock_acquire (&free_map_lock);
+  while (start < released_hi)
+    {
+      size_t end;
+
+      start = bitmap_scan (released, start, 1, true);
+      if (start == BITMAP_ERROR || start >= released_hi)
+        break;
+      end = bitmap_scan (released, start, 1, false);
+      if (end == BITMAP_ERROR || end > released_hi)
+        end = released_hi;
+      bitmap_set_multiple (released, start, end - start, false);
+      add_extent (start, end - start);
+      start = end;
+    }
+  released_cnt = 0;
+  released_lo = bitmap_size (released);
+  released_hi = 0;
+  lock_release (&free_map_lock);
+}
+
+/* Sets aside CNT free sectors for the holes of a file, to be
+   allocated one at a time with free_map_allocate_reserved().
+   Returns true if successful, false if fewer than CNT free
+   sectors are not already reserved. */
+bool
+free_map_reserve (size_t cnt)
+{
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  if (cnt <= available ())
+    {
+      mark_reserved (reserved_cnt + cnt);
+      success = true;
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Gives back CNT sectors reserved by free_map_reserve() that
+   will not be needed after all. */
+void
+free_map_unreserve (size_t cnt)
+{
+  if (cnt == 0)
+    return;
+  lock_acquire (&free_map_lock);
+  ASSERT (cnt <= reserved_cnt);
+  mark_reserved (reserved_cnt - cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Allocates one of the sectors reserved by free_map_reserve()
+   and stores it into *SECTORP.
+   Returns true if successful, false if memory is exhausted. */
+bool
+free_map_allocate_reserved (block_sector_t *sectorp)
+{
+  struct free_extent *e;
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  ASSERT (reserved_cnt > 0);
+  e = best_fit (1);
+  if (e != NULL)
+    {
+      block_sector_t sector = e->start;
+      if (take_extent (e, sector, 1))
+        {
+          mark_sectors (sector, 1, true);
+          mark_reserved (reserved_cnt - 1);
+          *sectorp = sector;
+          success = true;
+        }
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Writes the sectors of the free map file that have changed since
+   they were last written.  Called at sync points: by the buffer
+   cache's write-behind thread just before it flushes the cache,
+   and at free_map_close().
+
+   Changes to the free map are batched up to the next sync point,
+   so that allocating or releasing a few sectors costs at most one
+   free map sector per sync point instead of a rewrite of the whole
+   file each time.  Every sync point writes the free map into the
+   cache before the cache is flushed, so an inode or directory
+   written back at a sync point never refers to sectors that the
+   free map written with it still shows as free.  A sector that
+   fails to write stays dirty and is retried at the next sync
+   point. */
+void
+free_map_flush (void)
+{
+  size_t i = 0;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    while ((i = bitmap_scan (dirty_sectors, i, 1, true)) != BITMAP_ERROR)
+      {
+        if (bitmap_write_part (free_map, free_map_file,
+                               i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE)
+            && (i != (size_t) reserved_ofs / BLOCK_SECTOR_SIZE
+                || write_reserved ()))
+          {
+            bitmap_reset (dirty_sectors, i);
+            sector_write_cnt++;
+          }
+        i++;
+      }
+  lock_release (&free_map_lock);
+}
+
+/* Returns the number of free map file sectors that have changed
+   since they were last written. */
+size_t
+free_map_dirty_cnt (void)
+{
+  size_t cnt;
+
+  lock_acquire (&free_map_lock);
+  cnt = bitmap_count (dirty_sectors, 0, bitmap_size (dirty_sectors), true);
+  lock_release (&free_map_lock);
+  return cnt;
+}
+
+/* Prints free map statistics. */
+void
+free_map_print_stats (void)
+{
+  printf ("Free map: %llu sectors written\n", sector_write_cnt);
+}
+
+/* Returns the number of sectors that may be allocated without
+   eating into the ones reserved for holes. */
+static size_t
+available (void)
+{
+  return free_cnt - reserved_cnt - released_cnt;
+}
+
+/* Frees the CNT sectors starting at SECTOR in free_map, leaving
+   them out of the free extents until free_map_reuse(). */
+static void
+release (block_sector_t sector, size_t cnt)
 {
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  if (cnt == 0)
+    return;
+  mark_sectors (sector, cnt, false);
+  bitmap_set_multiple (released, sector, cnt, true);
+  released_cnt += cnt;
+  if (sector < released_lo)
+    released_lo = sector;
+  if (sector + cnt > released_hi)
+    released_hi = sector + cnt;
+}
+
+/* Sets the CNT bits of the free map starting at SECTOR to VALUE
+   and marks the free map file sectors that hold them dirty. */
+static void
+mark_sectors (block_sector_t sector, size_t cnt, bool value)
+{
+  size_t first, last, i;
+
+  if (cnt == 0)
+    return;
+  first = sector / BITS_PER_SECTOR;
+  last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (free_map, sector, cnt, value);
+  for (i = first; i <= last; i++)
+    mark_dirty (i);
+  if (value)
+    free_cnt -= cnt;
+  else
+    free_cnt += cnt;
+}
+
+/* Sets the number of reserved sectors to CNT and marks the free
+   map file sector that holds it dirty. */
+static void
+mark_reserved (uint32_t cnt)
+{
+  reserved_cnt = cnt;
+  mark_dirty (reserved_ofs / BLOCK_SECTOR_SIZE);
+}
+
+/* Marks free map file sector I dirty, counting it against the
+   current journal operation if it was clean. */
+static void
+mark_dirty (size_t i)
+{
+  if (!bitmap_test (dirty_sectors, i))
+    {
+      bitmap_mark (dirty_sectors, i);
+      journal_add_free_map ();
+    }
+}
+
+/* Writes the number of reserved sectors to the free map file.
+   Returns true if successful. */
+static bool
+write_reserved (void)
+{
+  return (file_write_at (free_map_file, &reserved_cnt, sizeof reserved_cnt,
+                         reserved_ofs)
+          == sizeof reserved_cnt);
+}
+
+/* Returns the smallest free extent with at least CNT sectors,
+   the lowest among equals, or a null pointer if there is
+   none. */
+static struct free_extent *
+best_fit (size_t cnt)
+{
+  struct free_extent key = { .start = 0, .cnt = cnt };
+  struct tree_elem *elem;
+
+  elem = tree_lower_bound (&by_size, &key.size_elem);
+  return elem != NULL ? tree_entry (elem, struct free_extent, size_elem) : NULL;
+}
+
+/* Adds the CNT free sectors at SECTOR to the free extents,
+   merging them with the extents just before and after.  If memory
+   is exhausted, the sectors stay free in free_map but cannot be
+   allocated until the index is next rebuilt. */
+static void
+add_extent (block_sector_t sector, size_t cnt)
+{
+  struct free_extent key = { .start = sector }, *prev = NULL, *next = NULL;
+  struct free_extent *e;
+  struct tree_elem *elem;
+
+  elem = tree_lower_bound (&by_start, &key.start_elem);
+  if (elem != NULL)
+    next = tree_entry (elem, struct free_extent, start_elem);
+  elem = elem != NULL ? tree_prev (elem) : tree_last (&by_start);
+  if (elem != NULL)
+    prev = tree_entry (elem, struct free_extent, start_elem);
+
+  if (prev != NULL && prev->start + prev->cnt == sector)
+    {
+      e = prev;
+      tree_remove (&by_size, &e->size_elem);
+      e->cnt += cnt;
+    }
+  else
+    {
+      e = malloc (sizeof *e);
+      if (e == NULL)
+        return;
+      e->start = sector;
+      e->cnt = cnt;
+      tree_insert (&by_start, &e->start_elem);
+    }
+
+  if (next != NULL && e->start + e->cnt == next->start)
+    {
+      e->cnt += next->cnt;
+      tree_remove (&by_start, &next->start_elem);
+      tree_remove (&by_size, &next->size_elem);
+      free (next);
+    }
+  tree_insert (&by_size, &e->size_elem);
+}
+
+/* Removes the CNT sectors at SECTOR, which must lie within E,
+   from the free extents.  Returns false if memory is exhausted
+   splitting E in two, leaving E unchanged. */
+static bool
+take_extent (struct free_extent *e, block_sector_t sector, size_t cnt)
+{
+  size_t head_cnt = sector - e->start;
+  size_t tail_cnt = e->start + e->cnt - (sector + cnt);
+
+  ASSERT (sector >= e->start && sector + cnt <= e->start + e->cnt);
+
+  if (head_cnt > 0 && tail_cnt > 0)
+    {
+      struct free_extent *tail = malloc (sizeof *tail);
+      if (tail == NULL)
+        return false;
+      tail->start = sector + cnt;
+      tail->cnt = tail_cnt;
+      tree_insert (&by_start, &tail->start_elem);
+      tree_insert (&by_size, &tail->size_elem);
+    }
+
+  tree_remove (&by_size, &e->size_elem);
+  if (head_cnt > 0)
+    e->cnt = head_cnt;
+  else if (tail_cnt > 0)
+    {
+      /* Moving the start within the gap keeps BY_START in
+         order. */
+      e->start = sector + cnt;
+      e->cnt = tail_cnt;
+    }
+  else
+    {
+      tree_remove (&by_start, &e->start_elem);
+      free (e);
+      return true;
+    }
+  tree_insert (&by_size, &e->size_elem);
+  return true;
+}
+
+/* Rebuilds the free extents from free_map. */
+static void
+build_index (void)
+{
+  size_t sector_cnt = bitmap_size (free_map);
+  size_t start = 0;
+
+  free_cnt = 0;
+  while (!tree_empty (&by_start))
+    {
+      struct free_extent *e = tree_entry (tree_first (&by_start),
+                                          struct free_extent, start_elem);
+      tree_remove (&by_start, &e->start_elem);
+      tree_remove (&by_size, &e->size_elem);
+      free (e);
+    }
+
+  for (;;)
+    {
+      size_t end;
+
+      start = bitmap_scan (free_map, start, 1, false);
+      if (start == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = sector_cnt;
+      add_extent (start, end - start);
+      free_cnt += end - start;
+      start = end;
+    }
+}
+
+/* Returns true if free extent A starts before B. */
+static bool
+start_less (const struct tree_elem *a_, const struct tree_elem *b_,
+            void *aux UNUSED)
+{
+  const struct free_extent *a = tree_entry (a_, struct free_extent,
+                                            start_elem);
+  const struct free_extent *b = tree_entry (b_, struct free_extent,
+                                            start_elem);
+  return a->start < b->start;
+}
+
+/* Returns true if free extent A is smaller than B, or the same
+   size and starts before it. */
+static bool
+size_less (const struct tree_elem *a_, const struct tree_elem *b_,
+           void *aux UNUSED)
+{
+  const struct free_extent *a = tree_entry (a_, struct free_extent,
+                                            size_elem);
+  const struct free_extent *b = tree_entry (b_, struct free_extent,
+                                            size_elem);
+  if (a->cnt != b->cnt)
+    return a->cnt < b->cnt;
+  return a->start < b->start;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,15 +634,24 @@ free_map_open (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
+  if (!bitmap_read (free_map, free_map_file)
+      || (file_read_at (free_map_file, &reserved_cnt, sizeof reserved_cnt,
+                        reserved_ofs)
+          != sizeof reserved_cnt))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty_sectors, false);
+  build_index ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
+  lock_acquire (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -73,13 +660,15 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, reserved_ofs + sizeof reserved_cnt,
+                     false))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap and reserved sector count to file. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, free_map_file) || !write_reserved ())
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_sectors, false);
 }
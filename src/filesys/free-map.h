@@ -10,8 +10,20 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_flush (void);
+void free_map_print_stats (void);
+size_t free_map_sectors (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+size_t free_map_allocate_upto (size_t, block_sector_t *);
+bool free_map_allocate_at (block_sector_t, size_t);
 void free_map_release (block_sector_t, size_t);
+size_t free_map_release_upto (block_sector_t, size_t);
+bool free_map_has_released (void);
+void free_map_reuse (void);
+size_t free_map_dirty_cnt (void);
+bool free_map_reserve (size_t);
+void free_map_unreserve (size_t);
+bool free_map_allocate_reserved (block_sector_t *);
 
 #endif /* filesys/free-map.h */
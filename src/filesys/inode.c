@@ -1,23 +1,112 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
+#include <limits.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of extents in an inode. */
+#define EXTENT_CNT 16
+
+/* Number of sector numbers in an index sector. */
+#define INDEX_CNT (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Most data sectors an inode can have. */
+#define MAX_SECTORS (INDEX_CNT * INDEX_CNT)
+
+/* Most bytes of data that can be stored in the inode itself. */
+#define INLINE_MAX 500
+
+/* Most bytes of a regular file written in one journal operation.
+   Its data sectors are not journaled, so the operation changes at
+   most the inode, the index of index sectors and the two index
+   sectors that the chunk's data sectors can span, and free map
+   sectors for those and the data sectors.  The free map changes
+   needed are not bounded by the chunk size, so a write stops early
+   when the operation runs short of room. */
+#define WRITE_CHUNK (64 * BLOCK_SECTOR_SIZE)
+#define WRITE_BLOCKS 4
+#define WRITE_FREE_MAP 8
+
+/* Most sectors, and most free map sectors, that writing one data
+   sector of a regular file can change: the inode, the index of
+   index sectors and an index sector, and the free map for the
+   latter two, the data sector and the count of reserved
+   sectors. */
+#define SECTOR_BLOCKS 3
+#define SECTOR_FREE_MAP 4
+
+/* Most sectors that grow_extents() allocates at once, so that each
+   allocation changes at most two free map sectors. */
+#define GROW_MAX (BLOCK_SECTOR_SIZE * CHAR_BIT)
+
+/* A run of consecutive data sectors.  Only the first WRITTEN of
+   them have ever been written; the rest are allocated but read as
+   zeros without touching the disk. */
+struct inode_extent
+  {
+    block_sector_t start;               /* First sector. */
+    uint32_t cnt;                       /* Number of sectors, 0 if unused. */
+    uint32_t written;                   /* Number of sectors written. */
+  };
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The first data sectors of the file are stored in EXTENTS, in
+   order, so a file written sequentially on a roomy disk needs no
+   metadata besides the inode.  Data sector I past the extents is
+   entry I % INDEX_CNT of the index sector found at entry
+   I / INDEX_CNT of the index of index sectors INDEX.
+
+   Extents only grow at their end and only while INDEX is 0, so
+   once a write leaves a hole past the extents or they cannot grow
+   any more, new sectors go to the index.  A sector number of 0 in
+   the index, which always belongs to the free map inode, marks a
+   sector that has not been allocated: it reads as zeros and is
+   allocated when first written.
+
+   Creating a file reserves extents for its data without writing
+   them, so that creating even a large file writes only the inode.
+   Data that does not fit in the extents is left as holes, and
+   RESERVED counts the free sectors set aside in the free map to
+   fill them and the index sectors that map them.
+   An extent's sectors are zeroed on demand as they are first
+   written.  A first write past an extent's written sectors splits
+   the extent there, so that only the written sector is zeroed,
+   unless every extent is in use; then the unwritten sectors before
+   it are zeroed too.
+
+   A file of at most INLINE_MAX bytes is instead stored in
+   INLINE_DATA, in place of the extents and index, so that it needs
+   no data sectors and is read along with its inode.  It moves out
+   to data sectors, for good, when it grows past INLINE_MAX. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
+    union
+      {
+        struct
+          {
+            struct inode_extent extents[EXTENT_CNT]; /* Runs of data sectors. */
+            block_sector_t index;       /* Index of index sectors, or 0. */
+            uint32_t reserved;          /* Free sectors reserved for holes. */
+          };
+        uint8_t inline_data[INLINE_MAX]; /* Data, if INLINED. */
+      };
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    bool inlined;                       /* Is the data in INLINE_DATA? */
+    bool is_dir;                        /* Is this a directory? */
+    uint8_t unused[2];                  /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,46 +120,401 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* True while DATA is being read. */
+    struct condition loaded;            /* Signaled when LOADING clears. */
+    struct lock lock;                   /* Protects the next two members
+                                           and changes to DATA. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock dir_lock;               /* See inode_lock_dir(). */
     struct inode_disk data;             /* Inode content. */
   };
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
-static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+/* Returns true if INODE's data is metadata, whose changes are
+   journaled: a directory or the free map. */
+static bool
+is_metadata (const struct inode *inode)
 {
-  ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  return inode->data.is_dir || inode->sector == FREE_MAP_SECTOR;
+}
+
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Writes SIZE bytes from BUFFER to SECTOR, starting at byte
+   offset OFS within the sector: through the journal if META,
+   because the sector holds metadata, otherwise straight into the
+   buffer cache. */
+static void
+write_sector (bool meta, block_sector_t sector, const void *buffer,
+              int ofs, int size)
+{
+  if (meta)
+    journal_write_at (sector, buffer, ofs, size);
   else
-    return -1;
+    cache_write_at (sector, buffer, ofs, size);
+}
+
+/* Allocates a sector, fills it with zeros, through the journal if
+   META, and stores its number in *SECTORP.  If RESERVE is non-null
+   and has sectors reserved, the sector is one of them and
+   *CHANGED is set.  Returns true if successful, false if the disk
+   is full. */
+static bool
+allocate_zeroed (block_sector_t *sectorp, bool meta,
+                 struct inode_disk *reserve, bool *changed)
+{
+  if (reserve != NULL && reserve->reserved > 0)
+    {
+      if (!free_map_allocate_reserved (sectorp))
+        return false;
+      reserve->reserved--;
+      *changed = true;
+    }
+  else if (!free_map_allocate (1, sectorp))
+    return false;
+  write_sector (meta, *sectorp, zeros, 0, BLOCK_SECTOR_SIZE);
+  return true;
+}
+
+/* Returns the index sector number in *SLOT.  If it is 0 and
+   ALLOCATE is true, allocates a zeroed sector first, from
+   RESERVE as allocate_zeroed() does, setting *CHANGED; if that
+   fails, returns 0. */
+static block_sector_t
+map_slot (block_sector_t *slot, bool allocate, struct inode_disk *reserve,
+          bool *changed)
+{
+  if (*slot == 0 && allocate && allocate_zeroed (slot, true, reserve, changed))
+    *changed = true;
+  return *slot;
+}
+
+/* Returns entry IDX of index sector INDEX.  If it is 0 and
+   ALLOCATE is true, allocates a zeroed sector for it first,
+   through the journal if META and from RESERVE as
+   allocate_zeroed() does; if that fails, returns 0. */
+static block_sector_t
+map_entry (block_sector_t index, size_t idx, bool allocate, bool meta,
+           struct inode_disk *reserve, bool *changed)
+{
+  block_sector_t sector;
+
+  cache_read_at (index, &sector, idx * sizeof sector, sizeof sector);
+  if (sector == 0 && allocate
+      && allocate_zeroed (&sector, meta, reserve, changed))
+    journal_write_at (index, &sector, idx * sizeof sector, sizeof sector);
+  return sector;
+}
+
+/* Returns the number of data sectors in DISK_INODE's extents, and
+   stores the number of extents in use in *USED. */
+static size_t
+extent_sectors (const struct inode_disk *disk_inode, size_t *used)
+{
+  size_t sectors = 0;
+  size_t i;
+
+  for (i = 0; i < EXTENT_CNT && disk_inode->extents[i].cnt > 0; i++)
+    sectors += disk_inode->extents[i].cnt;
+  *used = i;
+  return sectors;
+}
+
+/* Grows DISK_INODE's extents, if its index is not yet in use, to
+   hold data sectors up to END, or as close to it as the disk and
+   the journal operation allow, leaving room for the operation to
+   change KEEP more free map sectors.  The last extent is extended
+   in place when the sectors after it are free; otherwise a new
+   extent is allocated, best fit.  New sectors are not written, so
+   they read as zeros.
+   Returns true and sets *CHANGED if the extents grew at all. */
+static bool
+grow_extents (struct inode_disk *disk_inode, size_t end, size_t keep,
+              bool *changed)
+{
+  size_t used;
+  size_t sectors = extent_sectors (disk_inode, &used);
+  bool grew = false;
+
+  if (disk_inode->index != 0)
+    return false;
+
+  while (sectors < end)
+    {
+      struct inode_extent *last = used > 0 ? &disk_inode->extents[used - 1]
+                                           : NULL;
+      size_t want = end - sectors < GROW_MAX ? end - sectors : GROW_MAX;
+      size_t room = journal_free_map_room ();
+      size_t span = want > 1 ? 2 : 1;
+      block_sector_t sector;
+      size_t got;
+
+      if (room < span || room - span < keep)
+        break;
+      if (last != NULL
+          && free_map_allocate_at (last->start + last->cnt, want))
+        got = want;
+      else if (last != NULL
+               && free_map_allocate_at (last->start + last->cnt, 1))
+        got = 1;
+      else if (used < EXTENT_CNT
+               && (got = free_map_allocate_upto (want, &sector)) > 0)
+        {
+          last = &disk_inode->extents[used++];
+          last->start = sector;
+          last->cnt = last->written = 0;
+        }
+      else
+        break;
+
+      last->cnt += got;
+      sectors += got;
+      grew = *changed = true;
+    }
+  return grew;
+}
+
+/* Splits extent I of DISK_INODE in two, the second starting at
+   its sector OFS, which must be past its written sectors, and
+   shifts the extents after it up.  Returns false, changing
+   nothing, if every extent is in use. */
+static bool
+split_extent (struct inode_disk *disk_inode, size_t i, size_t ofs)
+{
+  struct inode_extent *e = &disk_inode->extents[i];
+
+  ASSERT (ofs >= e->written && ofs < e->cnt);
+
+  if (disk_inode->extents[EXTENT_CNT - 1].cnt > 0)
+    return false;
+  memmove (e + 1, e, (EXTENT_CNT - 1 - i) * sizeof *e);
+  e[1].start = e->start + ofs;
+  e[1].cnt = e->cnt - ofs;
+  e[1].written = 0;
+  e->cnt = ofs;
+  return true;
+}
+
+/* Returns the disk sector that holds data sector IDX of the file
+   described by DISK_INODE, or 0 if it is not allocated or has
+   never been written, in which case it reads as zeros.
+   If ALLOCATE is true, the sector is about to be written:
+   missing data and index sectors are allocated along the way,
+   unwritten sectors are zeroed, and *CHANGED is set if
+   DISK_INODE itself was modified; 0 is then returned only if the
+   disk is full or IDX is beyond MAX_SECTORS. */
+static block_sector_t
+map_sector (struct inode_disk *disk_inode, size_t idx, bool allocate,
+            bool *changed)
+{
+  struct inode_disk *reserve;
+  block_sector_t index;
+  size_t base = 0;
+  size_t i;
+
+  for (i = 0; i < EXTENT_CNT && disk_inode->extents[i].cnt > 0; i++)
+    {
+      struct inode_extent *e = &disk_inode->extents[i];
+
+      if (idx < base + e->cnt)
+        {
+          size_t ofs = idx - base;
+
+          if (ofs >= e->written)
+            {
+              if (!allocate)
+                return 0;
+              if (ofs > e->written && split_extent (disk_inode, i, ofs))
+                {
+                  e++;
+                  ofs = 0;
+                }
+
+              /* Zero the sectors up to and including this one
+                 through the cache.  Zeroing this sector costs no
+                 disk write when the caller overwrites it all.
+                 Only a directory's data is metadata here: the
+                 free map is written in full when created. */
+              for (; e->written <= ofs; e->written++)
+                write_sector (disk_inode->is_dir, e->start + e->written,
+                              zeros, 0, BLOCK_SECTOR_SIZE);
+              *changed = true;
+            }
+          return e->start + ofs;
+        }
+      base += e->cnt;
+    }
+
+  if (idx >= MAX_SECTORS)
+    return 0;
+  if (allocate && idx == base
+      && grow_extents (disk_inode, idx + 1, 0, changed))
+    return map_sector (disk_inode, idx, true, changed);
+
+  /* Index sectors are journaled, data sectors only for a
+     directory, as above.  Holes within the file's length are
+     filled from the sectors reserved for them. */
+  reserve = idx < bytes_to_sectors (disk_inode->length) ? disk_inode : NULL;
+  index = map_slot (&disk_inode->index, allocate, reserve, changed);
+  if (index != 0)
+    index = map_entry (index, idx / INDEX_CNT, allocate, true, reserve,
+                       changed);
+  return (index != 0
+          ? map_entry (index, idx % INDEX_CNT, allocate, disk_inode->is_dir,
+                       reserve, changed)
+          : 0);
+}
+
+/* Releases the CNT sectors at SECTOR, restarting the current
+   journal operation whenever it runs out of room to change the
+   free map.  Sectors allocated in the current operation take no
+   room, so releasing them never restarts it. */
+static void
+release_run (block_sector_t sector, size_t cnt)
+{
+  for (;;)
+    {
+      size_t n = free_map_release_upto (sector, cnt);
+
+      sector += n;
+      cnt -= n;
+      if (cnt == 0)
+        break;
+      journal_restart ();
+    }
 }
 
-/* List of open inodes, so that opening a single inode twice
+/* Releases SECTOR, if it is allocated, along with the sectors it
+   indexes if LEVEL is 1 or more: for LEVEL 1 its entries are data
+   sectors, for LEVEL 2 they are index sectors.  SECTOR itself
+   goes last, so that it is read only while still allocated. */
+static void
+release_tree (block_sector_t sector, int level)
+{
+  if (sector == 0)
+    return;
+  if (level > 0)
+    {
+      size_t i;
+
+      for (i = 0; i < INDEX_CNT; i++)
+        release_tree (map_entry (sector, i, false, false, NULL, NULL),
+                      level - 1);
+    }
+  release_run (sector, 1);
+}
+
+/* Releases all the data and index sectors in DISK_INODE's
+   extents and index, and the sectors reserved for its holes. */
+static void
+release_sectors (struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  free_map_unreserve (disk_inode->reserved);
+  disk_inode->reserved = 0;
+  for (i = 0; i < EXTENT_CNT && disk_inode->extents[i].cnt > 0; i++)
+    release_run (disk_inode->extents[i].start, disk_inode->extents[i].cnt);
+  release_tree (disk_inode->index, 2);
+}
+
+/* Releases all the data and index sectors of DISK_INODE. */
+static void
+deallocate (struct inode_disk *disk_inode)
+{
+  if (!disk_inode->inlined)
+    release_sectors (disk_inode);
+}
+
+/* Open inodes by sector, so that opening a single inode twice
    returns the same `struct inode'. */
-static struct list open_inodes;
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt and loading members of
+   each inode in it. */
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("open inode table creation failed");
+  lock_init (&open_inodes_lock);
 }
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   device.
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
+/* Reserves extents in DISK_INODE, which has none yet, for its
+   first SECTORS data sectors.  Sectors that do not fit in the
+   extents are left as holes, allocated when first written, and
+   free sectors are reserved in the free map for them and the
+   index sectors that will map them, so that filling them cannot
+   run out of space.  Returns true if successful; otherwise
+   releases the extents and returns false. */
+static bool
+reserve_sectors (struct inode_disk *disk_inode, size_t sectors)
+{
+  size_t room = journal_free_map_room ();
+  size_t used, base, index_cnt;
+  bool changed = false;
+
+  if (sectors > MAX_SECTORS)
+    return false;
+
+  /* Leave the caller's operation its room beyond what
+     inode_create() may use, and one for the reserved count. */
+  grow_extents (disk_inode, sectors,
+                room > INODE_CREATE_FREE_MAP
+                ? room - INODE_CREATE_FREE_MAP + 1 : 1, &changed);
+  base = extent_sectors (disk_inode, &used);
+  if (base == sectors)
+    return true;
+
+  /* The index of index sectors, and the index sectors that map
+     data sectors BASE through SECTORS - 1. */
+  index_cnt = 1 + (sectors - 1) / INDEX_CNT - base / INDEX_CNT + 1;
+  if (free_map_reserve (sectors - base + index_cnt))
+    {
+      disk_inode->reserved = sectors - base + index_cnt;
+      return true;
+    }
+
+  release_sectors (disk_inode);
+  return false;
+}
+
+/* Initializes an inode with LENGTH bytes of data, which read as
+   zeros, and writes the new inode to sector SECTOR on the file
+   system device.  Data that fits is kept in the inode; otherwise
+   space for it is reserved as far as the extents allow, but no
+   data sector is written until it is first written to.  The
+   inode is marked as a directory if IS_DIR is true.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or if the disk does
+   not have room for LENGTH bytes. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -85,21 +529,16 @@ inode_create (block_sector_t sector, off_t length)
   if (disk_inode != NULL)
     {
       size_t sectors = bytes_to_sectors (length);
+
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->inlined = length <= INLINE_MAX;
+      disk_inode->is_dir = is_dir;
+      if (disk_inode->inlined || reserve_sectors (disk_inode, sectors))
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
+          journal_write (sector, disk_inode);
+          success = true;
+        }
       free (disk_inode);
     }
   return success;
@@ -107,37 +546,57 @@ inode_create (block_sector_t sector, off_t length)
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails.
+   The first opener reads the inode without holding the table
+   lock; a concurrent opener of the same sector waits for it. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&inode->loaded, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, marked as loading until it has been read. */
   inode->sector = sector;
+  hash_insert (&open_inodes, &inode->elem);
   inode->open_cnt = 1;
+  inode->loading = true;
+  cond_init (&inode->loaded);
+  lock_init (&inode->lock);
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->dir_lock);
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->sector, &inode->data);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +605,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -157,6 +620,27 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Returns the number of openers of INODE. */
+int
+inode_open_cnt (const struct inode *inode)
+{
+  return inode->open_cnt;
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
@@ -168,21 +652,29 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      /* Remove from inode table and release lock. */
+      hash_delete (&open_inodes, &inode->elem);
+      lock_release (&open_inodes_lock);
  
-      /* Deallocate blocks if removed. */
+      /* Deallocate blocks if removed, in a journal operation of
+         their own unless part of one in progress.  A large file
+         takes several, so a crash partway through can leave some
+         of its sectors allocated but unused. */
       if (inode->removed) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          journal_begin (0, INODE_RELEASE_FREE_MAP);
+          deallocate (&inode->data);
+          release_run (inode->sector, 1);
+          journal_end ();
         }
 
       free (inode); 
     }
+  else
+    lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -191,129 +683,291 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inode->lock);
   inode->removed = true;
+  lock_release (&inode->lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   Data is copied out of the buffer cache with a cache entry
+   locked, so a user buffer must be pinned beforehand.
+   Each sector is mapped under INODE's lock, which a write holds
+   until its data is in place, but copied out after releasing it,
+   so that reads of one inode mostly overlap each other. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+
+  if (inode->data.inlined)
+    {
+      /* Inline data moves out to data sectors under the inode's
+         lock, so hold it while copying. */
+      lock_acquire (&inode->lock);
+      if (inode->data.inlined)
+        {
+          if (offset < inode->data.length)
+            {
+              bytes_read = inode->data.length - offset;
+              if (bytes_read > size)
+                bytes_read = size;
+              memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+            }
+          lock_release (&inode->lock);
+          return bytes_read;
+        }
+      lock_release (&inode->lock);
+    }
 
   while (size > 0) 
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      /* Disk sector to read, starting byte offset within sector.
+         A write splits and grows the extents in place, so map
+         the sector and read the length together under the lock. */
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      off_t inode_left;
+      int sector_left;
+      int min_left;
+      int chunk_size;
+
+      lock_acquire (&inode->lock);
+      sector_idx = map_sector (&inode->data, offset / BLOCK_SECTOR_SIZE,
+                               false, NULL);
+      inode_left = inode->data.length - offset;
+      lock_release (&inode->lock);
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually copy out of this sector. */
-      int chunk_size = size < min_left ? size : min_left;
+      chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
-
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+/* Starts fetching the sectors that hold the SIZE bytes of INODE
+   at OFFSET into the buffer cache in the background, stopping at
+   end of file.  Unallocated sectors are skipped. */
+void
+inode_read_ahead (struct inode *inode, off_t offset, off_t size) 
+{
+  off_t end = offset + size;
+
+  if (inode->data.inlined)
+    return;
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset -= offset % BLOCK_SECTOR_SIZE; offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector;
+
+      lock_acquire (&inode->lock);
+      sector = map_sector (&inode->data, offset / BLOCK_SECTOR_SIZE,
+                           false, NULL);
+      lock_release (&inode->lock);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+}
+
+/* Moves INODE's inline data out to a data sector, so that the
+   file can grow past INLINE_MAX bytes.  INODE's lock must be held.
+   Returns true if successful, false if memory or disk space runs
+   out, in which case the data stays inline. */
+static bool
+move_out_inline (struct inode *inode)
+{
+  struct inode_disk *disk_inode = &inode->data;
+  off_t length = disk_inode->length;
+  bool changed = false;
+  block_sector_t sector = 0;
+  uint8_t *saved;
+
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+  ASSERT (disk_inode->inlined);
+
+  saved = malloc (INLINE_MAX);
+  if (saved == NULL)
+    return false;
+  memcpy (saved, disk_inode->inline_data, INLINE_MAX);
+
+  /* Readers see INLINED until the data is in place, and wait for
+     the lock meanwhile. */
+  memset (disk_inode->inline_data, 0, INLINE_MAX);
+  if (length > 0)
+    {
+      grow_extents (disk_inode, bytes_to_sectors (length), 0, &changed);
+      sector = map_sector (disk_inode, 0, true, &changed);
+      if (sector == 0)
+        {
+          release_sectors (disk_inode);
+          memcpy (disk_inode->inline_data, saved, INLINE_MAX);
+          free (saved);
+          return false;
+        }
+      write_sector (is_metadata (inode), sector, saved, 0, length);
+    }
+  barrier ();
+  disk_inode->inlined = false;
+  free (saved);
+  return true;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   as inode_write_at() does, within the current journal
+   operation.  META is true if INODE's data is metadata. */
+static off_t
+write_at (struct inode *inode, const uint8_t *buffer, off_t size,
+          off_t offset, bool meta)
 {
-  const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool changed = false;
+  size_t used;
 
+  lock_acquire (&inode->lock);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      lock_release (&inode->lock);
+      return 0;
+    }
+
+  if (inode->data.inlined && size > 0)
+    {
+      if (offset + size <= INLINE_MAX)
+        {
+          /* Past end of file, INLINE_DATA is zeros, so a gap
+             before OFFSET reads as zeros too. */
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          bytes_written = size;
+          offset += size;
+          size = 0;
+          changed = true;
+        }
+      else if (move_out_inline (inode))
+        changed = true;
+      else
+        size = 0;
+    }
+
+  /* Allocate the sectors of a write that continues the extents
+     in one go, so that they stay contiguous. */
+  if (size > 0 && (size_t) offset / BLOCK_SECTOR_SIZE
+                  <= extent_sectors (&inode->data, &used))
+    grow_extents (&inode->data, bytes_to_sectors (offset + size),
+                  meta ? 0 : SECTOR_FREE_MAP, &changed);
 
   while (size > 0) 
     {
+      /* A regular file's write stops where the journal operation
+         could run out of room, and the caller goes on in
+         another. */
+      if (!meta && (journal_room () < SECTOR_BLOCKS
+                    || journal_free_map_room () < SECTOR_FREE_MAP))
+        break;
+
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = map_sector (&inode->data,
+                                              offset / BLOCK_SECTOR_SIZE,
+                                              true, &changed);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector, and number of bytes to actually write
+         into it. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
-
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      int chunk_size = size < sector_left ? size : sector_left;
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* The cache reads the sector in first unless the chunk
+         covers all of it. */
+      write_sector (meta, sector_idx, buffer + bytes_written, sector_ofs,
+                    chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+  if (bytes_written > 0 && offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      changed = true;
+    }
+  if (changed)
+    journal_write (inode->sector, &inode->data);
+  lock_release (&inode->lock);
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the disk fills up or the file reaches its
+   maximum size.
+   A write past end of file extends the file.  Sectors are
+   allocated as they are first written, so skipping over a range
+   leaves a hole that reads as zeros.  Writes to one inode are
+   serialized, and the new length becomes visible to readers only
+   once the data is in place.
+   A write to a directory or the free map must be made within a
+   journal operation.  A regular file is written in pieces, each
+   its own operation, so that none changes more metadata than an
+   operation may, and outside any operation. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+  bool retried = false;
+
+  if (is_metadata (inode))
+    return write_at (inode, buffer, size, offset, true);
+
+  while (bytes_written < size)
+    {
+      off_t chunk = size - bytes_written;
+      off_t chunk_written;
+
+      if (chunk > WRITE_CHUNK)
+        chunk = WRITE_CHUNK;
+      journal_begin (WRITE_BLOCKS, WRITE_FREE_MAP);
+      chunk_written = write_at (inode, buffer + bytes_written, chunk,
+                                offset + bytes_written, false);
+      journal_end ();
+
+      bytes_written += chunk_written;
+      if (chunk_written > 0)
+        retried = false;
+      else if (!retried && free_map_has_released ())
+        {
+          /* Sectors released by the running transaction become
+             free only when it commits. */
+          journal_commit ();
+          retried = true;
+        }
+      else
+        break;
+    }
   return bytes_written;
 }
 
@@ -322,8 +976,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +988,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&inode->lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -343,3 +1001,20 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Acquires the directory lock of INODE, which must be a
+   directory.  Held across each directory operation, so that
+   operations on one directory are atomic with respect to each
+   other while other directories and files stay unaffected. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases the directory lock of INODE. */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
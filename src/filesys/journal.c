@@ -0,0 +1,579 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* A write-ahead log of metadata changes.
+
+   Every change to an inode, an index sector, a directory or the
+   free map is made inside an operation, which journal_begin()
+   and journal_end() bracket, and written with journal_write().
+   The sectors changed by all the operations since the last
+   commit form the running transaction.  Its sectors stay pinned
+   in the buffer cache, so that none of them reaches its home
+   location before the whole transaction is safely in the log.
+
+   A commit waits for the operations in progress to end, holds
+   off new ones, and appends the transaction to the log in one
+   run of consecutive sectors: a descriptor block listing the
+   home sectors, a copy of each sector, and a commit block with a
+   checksum of the copies.  Then the sectors are unpinned and
+   reach their home locations whenever the cache writes them
+   back.  The log is checkpointed, by flushing the cache and
+   starting the log over, only when it is nearly full.
+
+   Each operation declares up front how many sectors it may add
+   to the transaction, and how many free map sectors it may
+   change, which join the transaction at commit.  An operation
+   begins only if the transaction has room for everything that
+   it and the operations in progress declared, so the pinned
+   sectors never fill the buffer cache or the descriptor block.
+   An operation that runs short, such as releasing a large
+   fragmented file, ends itself and begins again with
+   journal_restart().
+
+   Commits happen when the write-behind thread runs, when the
+   running transaction fills up, and at shutdown, so many
+   operations share each log write.  After a crash,
+   journal_open() redoes every transaction whose commit block
+   made it to the log, in order. */
+
+/* Sectors in the log. */
+#define LOG_SIZE 256
+
+/* Most sectors in the running transaction, including the free
+   map's.  They are pinned in the buffer cache, so this must
+   leave part of the cache free: 16 of its 64 entries. */
+#define TXN_MAX 48
+
+/* Magic numbers. */
+#define HEADER_MAGIC 0x4c4e524a         /* Journal header. */
+#define DESC_MAGIC 0x43534544           /* Descriptor block. */
+#define COMMIT_MAGIC 0x54494d43         /* Commit block. */
+
+/* Most sectors in a transaction, as many as a descriptor block
+   can list. */
+#define DESC_MAX 125
+
+/* Journal header, in sector JOURNAL_SECTOR.  Must be exactly
+   BLOCK_SECTOR_SIZE bytes long. */
+struct journal_header
+  {
+    uint32_t magic;                     /* HEADER_MAGIC. */
+    block_sector_t start;               /* First sector of the log. */
+    uint32_t size;                      /* Sectors in the log. */
+    uint32_t seq;                       /* Sequence number of the first
+                                           transaction in the log. */
+    uint8_t unused[496];                /* Not used. */
+  };
+
+/* First block of a logged transaction.  Must be exactly
+   BLOCK_SECTOR_SIZE bytes long. */
+struct descriptor
+  {
+    uint32_t magic;                     /* DESC_MAGIC. */
+    uint32_t seq;                       /* Sequence number. */
+    uint32_t cnt;                       /* Number of sectors. */
+    block_sector_t sectors[DESC_MAX];   /* Home location of each. */
+  };
+
+/* Last block of a logged transaction.  Must be exactly
+   BLOCK_SECTOR_SIZE bytes long. */
+struct commit_block
+  {
+    uint32_t magic;                     /* COMMIT_MAGIC. */
+    uint32_t seq;                       /* Sequence number. */
+    uint32_t checksum;                  /* Checksum of the copies. */
+    uint8_t unused[500];                /* Not used. */
+  };
+
+/* The log on disk. */
+static block_sector_t log_start;        /* First sector. */
+static size_t log_size;                 /* Number of sectors. */
+static size_t log_head;                 /* Next free sector, from LOG_START. */
+static uint32_t next_seq;               /* Next sequence number. */
+static bool active;                     /* Are changes journaled? */
+
+/* The running transaction.  Protected by journal_lock, except
+   that only the committer touches it while COMMITTING. */
+static block_sector_t txn_sectors[DESC_MAX]; /* Sectors changed. */
+static size_t txn_cnt;                  /* Number of sectors changed. */
+static int outstanding;                 /* Operations in progress. */
+static bool committing;                 /* Is a commit in progress? */
+static size_t free_map_changed;         /* Free map sectors changed. */
+static size_t reserved_blocks;          /* Sectors declared by the
+                                           operations in progress. */
+static size_t reserved_free_map;        /* Free map sectors declared by
+                                           the operations in progress. */
+static size_t free_map_cnt;             /* Sectors in the free map. */
+
+/* Protects the running transaction.  JOURNAL_COND is signaled
+   whenever an operation ends or a commit finishes. */
+static struct lock journal_lock;
+static struct condition journal_cond;
+
+/* Buffers for the committer and for recovery. */
+static struct descriptor desc;
+static struct commit_block commit;
+static uint8_t block[BLOCK_SECTOR_SIZE];
+
+/* Statistics. */
+static unsigned long long op_cnt;       /* Operations begun. */
+static unsigned long long commit_cnt;   /* Transactions committed. */
+static unsigned long long logged_cnt;   /* Sectors written to the log. */
+static unsigned long long checkpoint_cnt; /* Times the log was emptied. */
+static unsigned long long replay_cnt;   /* Transactions redone. */
+
+/* Initializes the journal.  Changes are not journaled until
+   journal_open(). */
+void
+journal_init (void)
+{
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+  free_map_cnt = free_map_sectors ();
+}
+
+/* Writes the journal header, recording that the log begins with
+   transaction NEXT_SEQ. */
+static void
+write_header (void)
+{
+  struct journal_header header;
+
+  ASSERT (sizeof header == BLOCK_SECTOR_SIZE);
+
+  memset (&header, 0, sizeof header);
+  header.magic = HEADER_MAGIC;
+  header.start = log_start;
+  header.size = log_size;
+  header.seq = next_seq;
+  block_write (fs_device, JOURNAL_SECTOR, &header);
+}
+
+/* Creates an empty log on a newly formatted file system. */
+void
+journal_create (void)
+{
+  size_t i;
+
+  if (!free_map_allocate (LOG_SIZE, &log_start))
+    PANIC ("journal creation failed");
+  log_size = LOG_SIZE;
+
+  /* Clear the log, so that nothing left on the disk passes for a
+     logged transaction. */
+  memset (block, 0, sizeof block);
+  for (i = 0; i < log_size; i++)
+    block_write (fs_device, log_start + i, block);
+
+  log_head = 0;
+  next_seq = 1;
+  write_header ();
+}
+
+/* Adds sector DATA to the checksum CHECKSUM and returns the
+   result. */
+static uint32_t
+add_checksum (uint32_t checksum, const void *data)
+{
+  return checksum * 31 + hash_bytes (data, BLOCK_SECTOR_SIZE);
+}
+
+/* Redoes each transaction in the log whose commit block was
+   written, in order, and stops at the first one that was not. */
+static void
+replay (void)
+{
+  ASSERT (sizeof desc == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof commit == BLOCK_SECTOR_SIZE);
+
+  log_head = 0;
+  while (log_head + 2 <= log_size)
+    {
+      block_sector_t pos = log_start + log_head;
+      uint32_t checksum = 0;
+      size_t i;
+
+      block_read (fs_device, pos, &desc);
+      if (desc.magic != DESC_MAGIC || desc.seq != next_seq
+          || desc.cnt > DESC_MAX || log_head + desc.cnt + 2 > log_size)
+        break;
+      block_read (fs_device, pos + desc.cnt + 1, &commit);
+      if (commit.magic != COMMIT_MAGIC || commit.seq != next_seq)
+        break;
+      for (i = 0; i < desc.cnt; i++)
+        {
+          block_read (fs_device, pos + i + 1, block);
+          checksum = add_checksum (checksum, block);
+        }
+      if (checksum != commit.checksum)
+        break;
+
+      for (i = 0; i < desc.cnt; i++)
+        {
+          block_read (fs_device, pos + i + 1, block);
+          block_write (fs_device, desc.sectors[i], block);
+        }
+      log_head += desc.cnt + 2;
+      next_seq++;
+      replay_cnt++;
+    }
+}
+
+/* Reads the journal header, redoes the committed transactions in
+   the log, empties it and starts journaling changes.  Must be
+   called before anything is read through the buffer cache. */
+void
+journal_open (void)
+{
+  struct journal_header header;
+
+  block_read (fs_device, JOURNAL_SECTOR, &header);
+  if (header.magic != HEADER_MAGIC)
+    PANIC ("journal not found--reformat the file system");
+  log_start = header.start;
+  log_size = header.size;
+  next_seq = header.seq;
+
+  replay ();
+  log_head = 0;
+  write_header ();
+  active = true;
+}
+
+/* Writes every committed sector in place and starts the log
+   over.  No operation may be in progress, so that no sector is
+   pinned. */
+static void
+checkpoint (void)
+{
+  cache_flush ();
+  log_head = 0;
+  write_header ();
+  checkpoint_cnt++;
+}
+
+/* Commits the running transaction and empties the log, so that
+   the file system is consistent on disk without it, and stops
+   journaling changes. */
+void
+journal_close (void)
+{
+  if (!active)
+    return;
+  journal_commit ();
+  active = false;
+  checkpoint ();
+}
+
+/* Returns true if the running transaction has no room for an
+   operation that adds up to BLOCKS sectors and changes up to
+   FREE_MAP free map sectors, besides all that the operations in
+   progress declared.  No more free map sectors can change
+   than the free map has.  journal_lock must be held. */
+static bool
+txn_full (size_t blocks, size_t free_map)
+{
+  size_t free_map_left = free_map_cnt - free_map_changed;
+  size_t free_map_more = reserved_free_map + free_map;
+
+  if (free_map_more > free_map_left)
+    free_map_more = free_map_left;
+  return (txn_cnt + free_map_changed + reserved_blocks + blocks
+          + free_map_more > TXN_MAX);
+}
+
+/* Adds OP to the running transaction, once it has room. */
+static void
+begin_op (struct journal_op *op)
+{
+  lock_acquire (&journal_lock);
+  while (committing || txn_full (op->blocks, op->free_map))
+    if (!committing && outstanding == 0)
+      {
+        /* Nobody else is going to commit the full transaction. */
+        lock_release (&journal_lock);
+        journal_commit ();
+        lock_acquire (&journal_lock);
+      }
+    else
+      cond_wait (&journal_cond, &journal_lock);
+  outstanding++;
+  reserved_blocks += op->blocks;
+  reserved_free_map += op->free_map;
+  op_cnt++;
+  lock_release (&journal_lock);
+  op->blocks_used = 0;
+  op->free_map_used = 0;
+}
+
+/* Ends OP, committing the running transaction if OP is the last
+   operation in progress and another like it would not fit. */
+static void
+end_op (struct journal_op *op)
+{
+  bool full;
+
+  lock_acquire (&journal_lock);
+  ASSERT (outstanding > 0);
+  outstanding--;
+  reserved_blocks -= op->blocks;
+  reserved_free_map -= op->free_map;
+  full = outstanding == 0 && txn_full (op->blocks, op->free_map);
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+
+  if (full)
+    journal_commit ();
+}
+
+/* Begins an operation that changes metadata, which adds at most
+   BLOCKS sectors to the running transaction and changes at most
+   FREE_MAP free map sectors.  Waits while a commit is in progress
+   or the running transaction has no room for it.  An operation
+   begun inside another is part of it, and is bound by its
+   limits. */
+void
+journal_begin (size_t blocks, size_t free_map)
+{
+  struct journal_op *op = &thread_current ()->journal_op;
+
+  if (!active)
+    return;
+  if (op->depth++ > 0)
+    return;
+
+  op->blocks = blocks;
+  op->free_map = free_map;
+  begin_op (op);
+}
+
+/* Ends an operation begun with journal_begin().  The last
+   operation to end commits the running transaction if it is
+   full. */
+void
+journal_end (void)
+{
+  struct journal_op *op = &thread_current ()->journal_op;
+
+  if (!active)
+    return;
+  ASSERT (op->depth > 0);
+  if (--op->depth == 0)
+    end_op (op);
+}
+
+/* Ends the current operation and begins another with the same
+   limits, for an operation that has run out of room.  Whatever
+   it changed so far may commit on its own, so it must have left
+   the file system consistent.  The caller must not hold any lock
+   that an operation may need. */
+void
+journal_restart (void)
+{
+  struct journal_op *op = &thread_current ()->journal_op;
+
+  if (!active)
+    return;
+  ASSERT (op->depth > 0);
+  end_op (op);
+  begin_op (op);
+}
+
+/* Returns how many more sectors the current operation may add
+   to the running transaction. */
+size_t
+journal_room (void)
+{
+  struct journal_op *op = &thread_current ()->journal_op;
+
+  return active ? op->blocks - op->blocks_used : SIZE_MAX;
+}
+
+/* Returns how many more free map sectors the current operation
+   may change. */
+size_t
+journal_free_map_room (void)
+{
+  struct journal_op *op = &thread_current ()->journal_op;
+
+  return active ? op->free_map - op->free_map_used : SIZE_MAX;
+}
+
+/* Counts a free map sector that the current operation changed
+   for the first time since the last commit.  It joins the
+   running transaction when the free map is written at commit.
+   Called with the free map locked. */
+void
+journal_add_free_map (void)
+{
+  struct journal_op *op = &thread_current ()->journal_op;
+
+  if (!active)
+    return;
+  ASSERT (op->depth > 0);
+  ASSERT (op->free_map_used < op->free_map);
+  op->free_map_used++;
+
+  lock_acquire (&journal_lock);
+  free_map_changed++;
+  lock_release (&journal_lock);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to metadata sector
+   SECTOR, as part of the current operation. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  journal_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to metadata sector SECTOR,
+   starting at byte offset OFS within the sector, as part of the
+   current operation.  The sector is not written in place until
+   the running transaction commits.  An operation may add no more
+   sectors to the transaction than it declared. */
+void
+journal_write_at (block_sector_t sector, const void *buffer,
+                  int ofs, int size)
+{
+  size_t i;
+
+  if (!active)
+    {
+      cache_write_at (sector, buffer, ofs, size);
+      return;
+    }
+
+  cache_write_pinned (sector, buffer, ofs, size);
+
+  lock_acquire (&journal_lock);
+  ASSERT (committing || thread_current ()->journal_op.depth > 0);
+  for (i = 0; i < txn_cnt; i++)
+    if (txn_sectors[i] == sector)
+      break;
+  if (i == txn_cnt)
+    {
+      if (txn_cnt >= DESC_MAX)
+        PANIC ("journal transaction too large");
+      txn_sectors[txn_cnt++] = sector;
+      if (!committing)
+        {
+          struct journal_op *op = &thread_current ()->journal_op;
+
+          ASSERT (op->blocks_used < op->blocks);
+          op->blocks_used++;
+        }
+    }
+  lock_release (&journal_lock);
+}
+
+/* Appends the running transaction to the log and unpins its
+   sectors.  Called only by the committer. */
+static void
+write_transaction (void)
+{
+  block_sector_t pos = log_start + log_head;
+  uint32_t checksum = 0;
+  size_t i;
+
+  ASSERT (log_head + txn_cnt + 2 <= log_size);
+
+  memset (&desc, 0, sizeof desc);
+  desc.magic = DESC_MAGIC;
+  desc.seq = next_seq;
+  desc.cnt = txn_cnt;
+  memcpy (desc.sectors, txn_sectors, txn_cnt * sizeof *txn_sectors);
+  block_write (fs_device, pos, &desc);
+
+  for (i = 0; i < txn_cnt; i++)
+    {
+      cache_read (txn_sectors[i], block);
+      checksum = add_checksum (checksum, block);
+      block_write (fs_device, pos + i + 1, block);
+    }
+
+  /* The transaction commits when this block is written. */
+  memset (&commit, 0, sizeof commit);
+  commit.magic = COMMIT_MAGIC;
+  commit.seq = next_seq;
+  commit.checksum = checksum;
+  block_write (fs_device, pos + txn_cnt + 1, &commit);
+
+  for (i = 0; i < txn_cnt; i++)
+    cache_unpin (txn_sectors[i]);
+
+  log_head += txn_cnt + 2;
+  logged_cnt += txn_cnt + 2;
+  next_seq++;
+  commit_cnt++;
+}
+
+/* Commits the running transaction, which includes every
+   operation that has ended.  Waits for operations in progress to
+   end first.  Sectors that the transaction freed become free
+   for reuse only once it has committed.  Without journaling,
+   just writes out the free map, so that callers need not care. */
+void
+journal_commit (void)
+{
+  size_t changed;
+
+  if (!active)
+    {
+      free_map_flush ();
+      free_map_reuse ();
+      return;
+    }
+
+  lock_acquire (&journal_lock);
+  if (committing)
+    {
+      /* The commit in progress takes in everything that has
+         ended, since no operation can begin until it is done. */
+      while (committing)
+        cond_wait (&journal_cond, &journal_lock);
+      lock_release (&journal_lock);
+      return;
+    }
+  committing = true;
+  while (outstanding > 0)
+    cond_wait (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+
+  /* The free map now matches the transaction's other changes. */
+  free_map_flush ();
+  if (txn_cnt > 0)
+    write_transaction ();
+  free_map_reuse ();
+  changed = free_map_dirty_cnt ();
+
+  /* Make sure that the log has room for the largest possible
+     transaction.  Nothing is pinned now. */
+  if (log_head + TXN_MAX + 2 > log_size)
+    checkpoint ();
+
+  lock_acquire (&journal_lock);
+  txn_cnt = 0;
+  free_map_changed = changed;
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %llu operations in %llu commits, %llu sectors logged, "
+          "%llu checkpoints, %llu transactions replayed\n",
+          op_cnt, commit_cnt, logged_cnt, checkpoint_cnt, replay_cnt);
+}
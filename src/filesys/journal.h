@@ -0,0 +1,34 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+/* The journal operation that a thread has in progress. */
+struct journal_op
+  {
+    int depth;                  /* Nesting of journal_begin() calls. */
+    size_t blocks;              /* Most sectors it may add. */
+    size_t free_map;            /* Most free map sectors it may change. */
+    size_t blocks_used;         /* Sectors it has added. */
+    size_t free_map_used;       /* Free map sectors it has changed. */
+  };
+
+void journal_init (void);
+void journal_create (void);
+void journal_open (void);
+void journal_close (void);
+
+void journal_begin (size_t blocks, size_t free_map);
+void journal_end (void);
+void journal_restart (void);
+size_t journal_room (void);
+size_t journal_free_map_room (void);
+void journal_add_free_map (void);
+void journal_write (block_sector_t, const void *);
+void journal_write_at (block_sector_t, const void *, int ofs, int size);
+void journal_commit (void);
+
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,293 @@
+#include "tree.h"
+#include "../debug.h"
+
+static int height (const struct tree_elem *);
+static void update_height (struct tree_elem *);
+static void replace_child (struct tree *, struct tree_elem *parent,
+                           struct tree_elem *old, struct tree_elem *new);
+static struct tree_elem *rotate_left (struct tree *, struct tree_elem *);
+static struct tree_elem *rotate_right (struct tree *, struct tree_elem *);
+static void rebalance (struct tree *, struct tree_elem *);
+static struct tree_elem *leftmost (struct tree_elem *);
+static struct tree_elem *rightmost (struct tree_elem *);
+
+/* Initializes tree T to compare elements using LESS, given
+   auxiliary data AUX. */
+void
+tree_init (struct tree *t, tree_less_func *less, void *aux)
+{
+  ASSERT (t != NULL);
+  ASSERT (less != NULL);
+
+  t->root = NULL;
+  t->elem_cnt = 0;
+  t->less = less;
+  t->aux = aux;
+}
+
+/* Inserts E into T, after any elements equal to it. */
+void
+tree_insert (struct tree *t, struct tree_elem *e)
+{
+  struct tree_elem *parent = NULL;
+  struct tree_elem **link = &t->root;
+
+  ASSERT (t != NULL);
+  ASSERT (e != NULL);
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      link = t->less (e, parent, t->aux) ? &parent->left : &parent->right;
+    }
+
+  e->parent = parent;
+  e->left = e->right = NULL;
+  e->height = 1;
+  *link = e;
+  t->elem_cnt++;
+
+  rebalance (t, parent);
+}
+
+/* Removes E, which must be in T, from T. */
+void
+tree_remove (struct tree *t, struct tree_elem *e)
+{
+  struct tree_elem *start;
+
+  ASSERT (t != NULL);
+  ASSERT (e != NULL);
+
+  if (e->left != NULL && e->right != NULL)
+    {
+      /* Replace E by its successor S, which has no left child. */
+      struct tree_elem *s = leftmost (e->right);
+
+      start = s->parent == e ? s : s->parent;
+      replace_child (t, s->parent, s, s->right);
+
+      s->left = e->left;
+      s->right = e->right;
+      if (s->left != NULL)
+        s->left->parent = s;
+      if (s->right != NULL)
+        s->right->parent = s;
+      s->height = e->height;
+      replace_child (t, e->parent, e, s);
+    }
+  else
+    {
+      start = e->parent;
+      replace_child (t, e->parent, e, e->left != NULL ? e->left : e->right);
+    }
+  t->elem_cnt--;
+
+  rebalance (t, start);
+}
+
+/* Returns the first element in T that is not less than KEY, or a
+   null pointer if there is none. */
+struct tree_elem *
+tree_lower_bound (const struct tree *t, const struct tree_elem *key)
+{
+  struct tree_elem *e = t->root;
+  struct tree_elem *result = NULL;
+
+  while (e != NULL)
+    if (t->less (e, key, t->aux))
+      e = e->right;
+    else
+      {
+        result = e;
+        e = e->left;
+      }
+  return result;
+}
+
+/* Returns the first element in T that is greater than KEY, or a
+   null pointer if there is none. */
+struct tree_elem *
+tree_upper_bound (const struct tree *t, const struct tree_elem *key)
+{
+  struct tree_elem *e = t->root;
+  struct tree_elem *result = NULL;
+
+  while (e != NULL)
+    if (t->less (key, e, t->aux))
+      {
+        result = e;
+        e = e->left;
+      }
+    else
+      e = e->right;
+  return result;
+}
+
+/* Returns the least element in T, or a null pointer if T is
+   empty. */
+struct tree_elem *
+tree_first (const struct tree *t)
+{
+  return t->root != NULL ? leftmost (t->root) : NULL;
+}
+
+/* Returns the greatest element in T, or a null pointer if T is
+   empty. */
+struct tree_elem *
+tree_last (const struct tree *t)
+{
+  return t->root != NULL ? rightmost (t->root) : NULL;
+}
+
+/* Returns the element after E in its tree, or a null pointer if
+   E is the last one. */
+struct tree_elem *
+tree_next (struct tree_elem *e)
+{
+  if (e->right != NULL)
+    return leftmost (e->right);
+  while (e->parent != NULL && e == e->parent->right)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the element before E in its tree, or a null pointer if
+   E is the first one. */
+struct tree_elem *
+tree_prev (struct tree_elem *e)
+{
+  if (e->left != NULL)
+    return rightmost (e->left);
+  while (e->parent != NULL && e == e->parent->left)
+    e = e->parent;
+  return e->parent;
+}
+
+/* Returns the number of elements in T. */
+size_t
+tree_size (const struct tree *t)
+{
+  return t->elem_cnt;
+}
+
+/* Returns true if T contains no elements, false otherwise. */
+bool
+tree_empty (const struct tree *t)
+{
+  return t->elem_cnt == 0;
+}
+
+/* Returns the height of the subtree rooted at E, which may be a
+   null pointer. */
+static int
+height (const struct tree_elem *e)
+{
+  return e != NULL ? e->height : 0;
+}
+
+/* Recomputes E's height from its children's. */
+static void
+update_height (struct tree_elem *e)
+{
+  int left = height (e->left);
+  int right = height (e->right);
+  e->height = (left > right ? left : right) + 1;
+}
+
+/* Makes NEW, which may be a null pointer, take OLD's place as a
+   child of PARENT, or as the root of T if PARENT is null. */
+static void
+replace_child (struct tree *t, struct tree_elem *parent,
+               struct tree_elem *old, struct tree_elem *new)
+{
+  if (parent == NULL)
+    t->root = new;
+  else if (parent->left == old)
+    parent->left = new;
+  else
+    parent->right = new;
+  if (new != NULL)
+    new->parent = parent;
+}
+
+/* Rotates the subtree rooted at E to the left and returns its
+   new root. */
+static struct tree_elem *
+rotate_left (struct tree *t, struct tree_elem *e)
+{
+  struct tree_elem *r = e->right;
+
+  e->right = r->left;
+  if (r->left != NULL)
+    r->left->parent = e;
+  replace_child (t, e->parent, e, r);
+  r->left = e;
+  e->parent = r;
+  update_height (e);
+  update_height (r);
+  return r;
+}
+
+/* Rotates the subtree rooted at E to the right and returns its
+   new root. */
+static struct tree_elem *
+rotate_right (struct tree *t, struct tree_elem *e)
+{
+  struct tree_elem *l = e->left;
+
+  e->left = l->right;
+  if (l->right != NULL)
+    l->right->parent = e;
+  replace_child (t, e->parent, e, l);
+  l->right = e;
+  e->parent = l;
+  update_height (e);
+  update_height (l);
+  return l;
+}
+
+/* Restores heights and balance from E, which may be a null
+   pointer, up to the root of T. */
+static void
+rebalance (struct tree *t, struct tree_elem *e)
+{
+  while (e != NULL)
+    {
+      int balance = height (e->left) - height (e->right);
+
+      if (balance > 1)
+        {
+          if (height (e->left->left) < height (e->left->right))
+            rotate_left (t, e->left);
+          e = rotate_right (t, e);
+        }
+      else if (balance < -1)
+        {
+          if (height (e->right->right) < height (e->right->left))
+            rotate_right (t, e->right);
+          e = rotate_left (t, e);
+        }
+      else
+        update_height (e);
+      e = e->parent;
+    }
+}
+
+/* Returns the least element in the subtree rooted at E. */
+static struct tree_elem *
+leftmost (struct tree_elem *e)
+{
+  while (e->left != NULL)
+    e = e->left;
+  return e;
+}
+
+/* Returns the greatest element in the subtree rooted at E. */
+static struct tree_elem *
+rightmost (struct tree_elem *e)
+{
+  while (e->right != NULL)
+    e = e->right;
+  return e;
+}
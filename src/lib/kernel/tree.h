@@ -0,0 +1,80 @@
+#ifndef __LIB_KERNEL_TREE_H
+#define __LIB_KERNEL_TREE_H
+
+/* Balanced binary search tree.
+
+   This is an AVL tree: the heights of the two subtrees of any
+   node differ by at most one, so insertion, removal and lookup
+   take O(log n) time.
+
+   Like lists and hash tables, trees do not use dynamic
+   allocation.  Each structure that can potentially be in a tree
+   must embed a struct tree_elem member, and the tree_entry macro
+   converts a struct tree_elem back to the structure that
+   contains it.  A structure may be in several trees at once by
+   embedding several struct tree_elem members, for example to
+   keep it ordered by two different keys.
+
+   Elements that compare equal are allowed; among them, an
+   element inserted later comes after those inserted earlier. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree element. */
+struct tree_elem
+  {
+    struct tree_elem *parent;   /* Parent, or null pointer for root. */
+    struct tree_elem *left;     /* Left child, or null pointer. */
+    struct tree_elem *right;    /* Right child, or null pointer. */
+    int height;                 /* Height of subtree rooted here. */
+  };
+
+/* Converts pointer to tree element TREE_ELEM into a pointer to
+   the structure that TREE_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the tree element. */
+#define tree_entry(TREE_ELEM, STRUCT, MEMBER)           \
+        ((STRUCT *) ((uint8_t *) &(TREE_ELEM)->height   \
+                     - offsetof (STRUCT, MEMBER.height)))
+
+/* Compares the value of two tree elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool tree_less_func (const struct tree_elem *a,
+                             const struct tree_elem *b,
+                             void *aux);
+
+/* Tree. */
+struct tree
+  {
+    struct tree_elem *root;     /* Root, or null pointer if empty. */
+    size_t elem_cnt;            /* Number of elements in tree. */
+    tree_less_func *less;       /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void tree_init (struct tree *, tree_less_func *, void *aux);
+
+/* Insertion and removal. */
+void tree_insert (struct tree *, struct tree_elem *);
+void tree_remove (struct tree *, struct tree_elem *);
+
+/* Search. */
+struct tree_elem *tree_lower_bound (const struct tree *,
+                                    const struct tree_elem *);
+struct tree_elem *tree_upper_bound (const struct tree *,
+                                    const struct tree_elem *);
+
+/* Traversal. */
+struct tree_elem *tree_first (const struct tree *);
+struct tree_elem *tree_last (const struct tree *);
+struct tree_elem *tree_next (struct tree_elem *);
+struct tree_elem *tree_prev (struct tree_elem *);
+
+/* Information. */
+size_t tree_size (const struct tree *);
+bool tree_empty (const struct tree *);
+
+#endif /* lib/kernel/tree.h */
@@ -28,7 +28,14 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Console. */
+    SYS_TTYMODE                 /* Sets how console input is read. */
   };
 
+/* Mode bits for SYS_TTYMODE. */
+#define TTY_CANONICAL 0x1       /* Deliver whole edited lines. */
+#define TTY_ECHO 0x2            /* Echo keys to the console. */
+
 #endif /* lib/syscall-nr.h */
@@ -182,3 +182,9 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+ttymode (int mode, int vmin, int vtime)
+{
+  return syscall3 (SYS_TTYMODE, mode, vmin, vtime);
+}
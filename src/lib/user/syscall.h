@@ -45,4 +45,7 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Console. */
+int ttymode (int mode, int vmin, int vtime);
+
 #endif /* lib/user/syscall.h */
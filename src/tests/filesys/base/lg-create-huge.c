@@ -0,0 +1,19 @@
+/* Tries to create a file larger than the whole file system,
+   which must fail, then creates one that fits. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Twice the size of the 2 MB file system the tests run on, but
+   within the largest file size. */
+#define HUGE_SIZE (4 * 1024 * 1024)
+
+void
+test_main (void) 
+{
+  msg ("create \"huge\"");
+  if (create ("huge", HUGE_SIZE))
+    fail ("create \"huge\" succeeded without room for its data");
+  CHECK (create ("blargle", 75678), "create \"blargle\"");
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-create-huge) begin
+(lg-create-huge) create "huge"
+(lg-create-huge) create "blargle"
+(lg-create-huge) end
+EOF
+pass;
@@ -0,0 +1,73 @@
+/* Creates many files, opens all of them so that they are open
+   at the same time, and reports how many CPU cycles each open
+   took.  The rate varies from run to run, so the test only
+   checks that every file could be opened.  A kernel run with a
+   descriptor limit below FILE_CNT, through -fl, runs out of
+   descriptors first; then the test checks that the file that
+   failed to open does open once a descriptor is free. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Number of files.  Each one takes a file descriptor while
+   open, as many as the default per-process limit allows. */
+#define FILE_CNT 1000
+
+static int fds[FILE_CNT];
+
+/* Returns the CPU's time-stamp counter, which counts cycles. */
+static inline uint64_t
+read_tsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+void
+test_main (void)
+{
+  char name[16];
+  uint64_t start, cycles;
+  int open_cnt;
+  int i;
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+  msg ("created %d files", FILE_CNT);
+
+  start = read_tsc ();
+  for (open_cnt = 0; open_cnt < FILE_CNT; open_cnt++)
+    {
+      snprintf (name, sizeof name, "file%d", open_cnt);
+      fds[open_cnt] = open (name);
+      if (fds[open_cnt] < 2)
+        break;
+    }
+  cycles = read_tsc () - start;
+
+  if (open_cnt < FILE_CNT)
+    {
+      /* Out of descriptors, or a real failure to open NAME. */
+      if (open_cnt == 0)
+        fail ("open \"%s\"", name);
+      close (fds[open_cnt - 1]);
+      fds[open_cnt - 1] = open (name);
+      if (fds[open_cnt - 1] < 2)
+        fail ("open \"%s\"", name);
+      msg ("out of descriptors after %d files", open_cnt);
+    }
+  msg ("opened %d files", open_cnt);
+  msg ("open rate: %llu cycles per open", cycles / open_cnt);
+
+  for (i = 0; i < open_cnt; i++)
+    close (fds[i]);
+  msg ("closed %d files", open_cnt);
+}
@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+
+# The open rate differs from run to run.
+fail "missing open rate in output\n"
+  unless grep (/^\(open-many\) open rate: \d+ cycles per open$/, @output);
+@output = grep (!/^\(open-many\) open rate: /, @output);
+
+# A kernel run with a lower descriptor limit, through -fl, opens
+# fewer files at once.
+my ($opened) = 1000;
+my ($limited) = grep (/^\(open-many\) out of descriptors after/, @output);
+($opened) = $limited =~ /after (\d+) files$/ if defined $limited;
+@output = grep (!/^\(open-many\) out of descriptors after/, @output);
+
+compare_output ("run", IGNORE_EXIT_CODES => 1, \@output, [<<EOF]);
+(open-many) begin
+(open-many) created 1000 files
+(open-many) opened $opened files
+(open-many) closed $opened files
+(open-many) end
+EOF
+pass;
@@ -13,8 +13,10 @@
 #include "devices/serial.h"
 #include "devices/shutdown.h"
 #include "devices/timer.h"
+#include "devices/tty.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -37,6 +39,11 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -109,6 +116,7 @@ int pintos_init(void)
   timer_init();
   kbd_init();
   input_init();
+  tty_init();
 #ifdef USERPROG
   exception_init();
   syscall_init();
@@ -125,6 +133,12 @@ int pintos_init(void)
   locate_block_devices();
   filesys_init(format_filesys);
 #endif
+
+#ifdef VM
+  /* Initialize virtual memory. */
+  frame_init();
+  swap_init();
+#endif
   printf("Boot complete.\n");
 
   if (*argv != NULL)
@@ -203,6 +217,14 @@ int pintos_init(void)
           thread_print_stats();
         }
 
+#ifdef USERPROG
+        // system call statistics
+        else if (strcmp(data, "syscalls") == 0)
+        {
+          syscall_print_stats();
+        }
+#endif
+
         // the number of seconds passed since Unix epoch
         else if (strcmp(data, "time") == 0)
         {
@@ -245,6 +267,29 @@ bss_init(void)
   memset(&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Returns the feature flags that CPUID leaf 1 reports in EDX, or
+   0 on a CPU too old to have CPUID, which is one that cannot
+   change the ID flag in EFLAGS.  See [IA32-v2a] "CPUID--CPU
+   Identification". */
+static uint32_t
+cpuid_features(void)
+{
+  uint32_t flags, changed, eax, ebx, ecx, edx;
+
+  asm volatile("pushfl; popl %0; movl %0, %1; xorl %2, %1; "
+               "pushl %1; popfl; pushfl; popl %1; pushl %0; popfl"
+               : "=&r"(flags), "=&r"(changed)
+               : "i"(FLAG_ID)
+               : "cc");
+  if (((flags ^ changed) & FLAG_ID) == 0)
+    return 0;
+
+  asm volatile("cpuid"
+               : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+               : "a"(1));
+  return edx;
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
@@ -254,6 +299,10 @@ paging_init(void)
 {
   uint32_t *pd, *pt;
   size_t page;
+  uint32_t features = cpuid_features();
+  bool large_pages = (features & CPUID_PSE) != 0;
+  uint32_t global = (features & CPUID_PGE) != 0 ? PTE_G : 0;
+  uint32_t cr4;
   extern char _start, _end_kernel_text;
 
   pd = init_page_dir = palloc_get_page(PAL_ASSERT | PAL_ZERO);
@@ -266,13 +315,42 @@ paging_init(void)
     size_t pte_idx = pt_no(vaddr);
     bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+    /* Map each 4 MB region that lies wholly in RAM with a single
+       large page, saving a page table and a level of every TLB
+       miss, if the CPU supports it.  The region that holds
+       kernel text keeps 4 kB pages so that the text alone can be
+       read-only. */
+    if (large_pages && pte_idx == 0 && page + PGSIZE / sizeof *pt <= init_ram_pages && (pde_idx < pd_no(&_start) || pde_idx > pd_no(&_end_kernel_text - 1)))
+    {
+      pd[pde_idx] = pde_create_kernel_large(vaddr, true) | global;
+      page += PGSIZE / sizeof *pt - 1;
+      continue;
+    }
+
     if (pd[pde_idx] == 0)
     {
       pt = palloc_get_page(PAL_ASSERT | PAL_ZERO);
       pd[pde_idx] = pde_create(pt);
     }
 
-    pt[pte_idx] = pte_create_kernel(vaddr, !in_kernel_text);
+    pt[pte_idx] = pte_create_kernel(vaddr, !in_kernel_text) | global;
+  }
+
+  /* Enable 4 MB pages before they are first used, and global
+     pages so that the kernel mappings above, which are the same
+     in every page directory, survive CR3 loads, as far as the CPU
+     supports them.  See [IA32-v3a] 3.6.1 "Paging Options" and
+     3.12 "Translation Lookaside Buffers (TLBs)". */
+  cr4 = (large_pages ? CR4_PSE : 0) | (global ? CR4_PGE : 0);
+  if (cr4 != 0)
+  {
+    uint32_t old_cr4;
+
+    asm volatile("movl %%cr4, %0"
+                 : "=r"(old_cr4));
+    asm volatile("movl %0, %%cr4"
+                 :
+                 : "r"(old_cr4 | cr4));
   }
 
   /* Store the physical address of the page directory into CR3
@@ -356,6 +434,12 @@ parse_options(char **argv)
 #ifdef USERPROG
     else if (!strcmp(name, "-ul"))
       user_page_limit = atoi(value);
+    else if (!strcmp(name, "-fl"))
+      fd_limit = atoi(value);
+#endif
+#ifdef VM
+    else if (!strcmp(name, "-sl"))
+      stack_page_limit = atoi(value);
 #endif
     else
       PANIC("unknown option `%s' (use -h for help)", name);
@@ -477,6 +561,10 @@ usage(void)
          "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
          "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+         "  -fl=COUNT          Limit each process to COUNT file descriptors.\n"
+#endif
+#ifdef VM
+         "  -sl=COUNT          Limit each user stack to COUNT pages.\n"
 #endif
   );
   shutdown_power_off();
@@ -66,6 +66,17 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_U 0x4               /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80             /* 1=4 MB page, 0=page table (PDEs only). */
+#define PTE_G 0x100             /* 1=global, kept in TLB across CR3 loads. */
+
+/* Bits in control register CR4 that govern paging. */
+#define CR4_PSE 0x10            /* 1=PDEs may map 4 MB pages. */
+#define CR4_PGE 0x80            /* 1=honor PTE_G. */
+
+/* Bits that CPUID leaf 1 reports in EDX for the paging options
+   above.  A CPU without them faults on setting the CR4 bit. */
+#define CPUID_PSE 0x8           /* 4 MB pages supported. */
+#define CPUID_PGE 0x2000        /* Global pages supported. */
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt) {
@@ -73,10 +84,20 @@ static inline uint32_t pde_create (uint32_t *pt) {
   return vtop (pt) | PTE_U | PTE_P | PTE_W;
 }
 
+/* Returns a PDE that maps the PTSPAN bytes starting at kernel
+   virtual address VADDR as a single 4 MB page, with the same
+   permissions as pte_create_kernel().  Only takes effect while
+   the PSE bit is set in CR4. */
+static inline uint32_t pde_create_kernel_large (void *vaddr, bool writable) {
+  ASSERT (((uintptr_t) vaddr & (PTSPAN - 1)) == 0);
+  return vtop (vaddr) | PTE_PS | PTE_P | (writable ? PTE_W : 0);
+}
+
 /* Returns a pointer to the page table that page directory entry
-   PDE, which must "present", points to. */
+   PDE, which must "present" and not a 4 MB page, points to. */
 static inline uint32_t *pde_get_pt (uint32_t pde) {
   ASSERT (pde & PTE_P);
+  ASSERT ((pde & PTE_PS) == 0);
   return ptov (pde & PTE_ADDR);
 }
 
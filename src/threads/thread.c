@@ -357,7 +357,6 @@ void thread_exit(void)
 #ifdef USERPROG
   process_exit();
 #endif
-
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
@@ -566,9 +565,20 @@ init_thread(struct thread *t, const char *name, int priority)
   intr_set_level(old_level);
 
 #ifdef USERPROG
-  list_init(&t->file_descriptors);
+  t->files = NULL;
+  t->file_cnt = 0;
+  t->free_fd = FD_MIN;
   list_init(&t->child_list);
   t->pcb = NULL;
+  t->executable = NULL;
+#endif
+#ifdef FILESYS
+  t->cwd = NULL;
+  t->journal_op.depth = 0;
+#endif
+#ifdef VM
+  lock_init(&t->spt_lock);
+  list_init(&t->mmap_list);
 #endif
 }
 
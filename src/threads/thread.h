@@ -4,6 +4,13 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#ifdef VM
+#include <hash.h>
+#include "threads/synch.h"
+#endif
+#ifdef FILESYS
+#include "filesys/journal.h"
+#endif
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -104,7 +111,24 @@ struct thread
     uint32_t *pagedir;                  /* Page directory. */
     struct process_control_block *pcb;  /* Process control block. */
     struct list child_list;             /* List of child processes. */
-    struct list file_descriptors;       /* List of open files. */
+    struct file **files;                /* Open files, indexed by fd. */
+    int file_cnt;                       /* Number of slots in files. */
+    int free_fd;                        /* No fd below this is free. */
+    struct file *executable;            /* Executable, kept open while running. */
+#endif
+#ifdef FILESYS
+    /* Owned by filesys/filesys.c. */
+    struct dir *cwd;                    /* Working directory, null for root. */
+
+    /* Owned by filesys/journal.c. */
+    struct journal_op journal_op;       /* Journal operation in progress. */
+#endif
+#ifdef VM
+    /* Owned by vm/page.c. */
+    struct hash spt;                    /* Supplemental page table. */
+    struct lock spt_lock;               /* Protects spt and its frames. */
+    struct list mmap_list;              /* List of memory-mapped files. */
+    void *user_esp;                     /* User stack pointer on syscall entry. */
 #endif
 
     /* Owned by thread.c. */
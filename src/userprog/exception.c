@@ -5,6 +5,9 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -149,6 +152,18 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+#ifdef VM
+  /* Bring in a page that is part of the address space but not
+     yet resident, or grow the stack.  This also covers kernel
+     accesses to user memory made on behalf of a system call, for
+     which F->esp is the kernel's, so the user stack pointer
+     saved on system call entry is used instead. */
+  if (not_present
+      && page_fault_in (fault_addr,
+                        user ? f->esp : thread_current ()->user_esp))
+    return;
+#endif
+
   /* If kernel mode */
   if (!user)
     {
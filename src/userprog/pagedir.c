@@ -7,10 +7,14 @@
 #include "threads/palloc.h"
 
 static uint32_t *active_pd (void);
+static void load_pd (uint32_t *);
 static void invalidate_pagedir (uint32_t *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
+   The copy shares the kernel's page tables, of which there is
+   only the one that covers kernel text if the CPU supports
+   4 MB pages.
    Returns the new page directory, or a null pointer if memory
    allocation fails. */
 uint32_t *
@@ -156,6 +160,15 @@ pagedir_clear_page (uint32_t *pd, void *upage)
     }
 }
 
+/* Returns true if virtual page VPAGE is mapped writable in PD,
+   false if it is read-only or not mapped at all. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage) 
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & PTE_P) != 0 && (*pte & PTE_W) != 0;
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -215,18 +228,26 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
 }
 
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is loaded already.  Loading CR3 flushes
+   every non-global TLB entry, so it is worth avoiding. */
 void
 pagedir_activate (uint32_t *pd)
 {
   if (pd == NULL)
     pd = init_page_dir;
 
-  /* Store the physical address of the page directory into CR3
-     aka PDBR (page directory base register).  This activates our
-     new page tables immediately.  See [IA32-v2a] "MOV--Move
-     to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
-     Address of the Page Directory". */
+  if (active_pd () != pd)
+    load_pd (pd);
+}
+
+/* Stores the physical address of page directory PD into CR3 aka
+   PDBR (page directory base register).  This activates the new
+   page tables immediately.  See [IA32-v2a] "MOV--Move to/from
+   Control Registers" and [IA32-v3a] 3.7.5 "Base Address of the
+   Page Directory". */
+static void
+load_pd (uint32_t *pd)
+{
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
 }
 
@@ -256,8 +277,9 @@ invalidate_pagedir (uint32_t *pd)
 {
   if (active_pd () == pd)
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      /* Reloading PD clears the TLB, except for the kernel's
+         global entries.  See [IA32-v3a] 3.12 "Translation
+         Lookaside Buffers (TLBs)". */
+      load_pd (pd);
     }
 }
@@ -19,6 +19,12 @@
 #include "threads/malloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
+
+int fd_limit = FD_LIMIT;
 
 static thread_func start_process NO_RETURN;
 static bool load(const char *cmdline, void (**eip)(void), void **esp);
@@ -59,6 +65,7 @@ pid_t process_execute(const char *file_name)
   /* Initialize Process Control Block (PCB) */
   pcb->pid = -2;
   pcb->command = file_name_copy;
+  pcb->cwd = thread_current()->cwd;
   pcb->waiting = false;
   pcb->exited = false;
   pcb->exit_code = -1;
@@ -119,7 +126,13 @@ start_process(void *pcb_)
   interrupt_frame.gs = interrupt_frame.fs = interrupt_frame.es = interrupt_frame.ds = interrupt_frame.ss = SEL_UDSEG;
   interrupt_frame.cs = SEL_UCSEG;
   interrupt_frame.eflags = FLAG_IF | FLAG_MBS;
-  load_success = load(command, &interrupt_frame.eip, &interrupt_frame.esp);
+
+  /* Start in the parent's working directory, which stays open
+     while the parent waits for this process to load. */
+  if (pcb->cwd != NULL && (thread_current()->cwd = dir_reopen(pcb->cwd)) == NULL)
+    load_success = false;
+  else
+    load_success = load(command, &interrupt_frame.eip, &interrupt_frame.esp);
 
   if (load_success)
     pushing_arguments_to_the_stack(arguments, argument_count, &interrupt_frame.esp);
@@ -211,15 +224,23 @@ void process_exit(void)
   uint32_t *page_directory;
 
   /* Close all opened files and free memory */
-  struct list *file_descriptors = &current_thread->file_descriptors;
-  struct file_desc *file_descriptor;
-
-  while (!list_empty(file_descriptors))
-  {
-    file_descriptor = list_entry(list_pop_front(file_descriptors), struct file_desc, elem);
-    file_close(file_descriptor->file);
-    free(file_descriptor);
-  }
+  for (int fd = FD_MIN; fd < current_thread->file_cnt; fd++)
+    file_close(current_thread->files[fd]);
+  free(current_thread->files);
+  current_thread->files = NULL;
+  current_thread->file_cnt = 0;
+  dir_close(current_thread->cwd);
+  current_thread->cwd = NULL;
+
+  /* Write back and drop memory mappings, then the rest of the
+     address space description, then the executable that backs
+     it. */
+#ifdef VM
+  mmap_unmap_all();
+  page_table_destroy(&current_thread->spt);
+#endif
+  file_close(current_thread->executable);
+  current_thread->executable = NULL;
 
   /* Free PCBs of all child processes */
   struct list *child_processes = &current_thread->child_list;
@@ -259,8 +280,13 @@ void process_activate(void)
 {
   struct thread *t = thread_current();
 
-  /* Activate thread's page tables. */
-  pagedir_activate(t->pagedir);
+  /* Activate thread's page tables.  A kernel thread never touches
+     user memory, so it borrows whichever page directory is loaded
+     instead of flushing the TLB to switch to the kernel-only one;
+     switching back to the same process then costs nothing
+     either. */
+  if (t->pagedir != NULL)
+    pagedir_activate(t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -355,6 +381,10 @@ bool load(const char *file_name, void (**entry_point)(void), void **stack_ptr)
   if (current_thread->pagedir == NULL)
     goto done;
   process_activate();
+#ifdef VM
+  if (!page_table_init(&current_thread->spt))
+    goto done;
+#endif
 
   /* Open the executable file. */
   executable_file = filesys_open(file_name);
@@ -363,6 +393,9 @@ bool load(const char *file_name, void (**entry_point)(void), void **stack_ptr)
     printf("load: %s: open failed\n", file_name);
     goto done;
   }
+  /* Pages of a running executable may be read at any time and
+     shared with other processes, so it must not change. */
+  file_deny_write(executable_file);
 
   /* Read and verify the executable header. */
   if (file_read(executable_file, &elf_header, sizeof elf_header) != sizeof elf_header || memcmp(elf_header.e_ident, "\177ELF\1\1\1", 7) || elf_header.e_type != 2 || elf_header.e_machine != 3 || elf_header.e_version != 1 || elf_header.e_phentsize != sizeof(struct Elf32_Phdr) || elf_header.e_phnum > 1024)
@@ -438,14 +471,18 @@ bool load(const char *file_name, void (**entry_point)(void), void **stack_ptr)
   load_success = true;
 
 done:
-  /* We arrive here whether the load is successful or not. */
-  file_close(executable_file);
+  /* We arrive here whether the load is successful or not.
+     The executable stays open until process_exit(), since with
+     virtual memory its pages are only read on first access. */
+  current_thread->executable = executable_file;
   return load_success;
 }
 
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page(void *upage, void *kpage, bool writable);
+#endif
 
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -504,6 +541,10 @@ validate_segment(const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With virtual memory the pages are only recorded in the
+   supplemental page table here and are read in by the page
+   fault handler on first access.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 
@@ -524,6 +565,11 @@ load_segment(struct file *file, off_t file_offset, uint8_t *user_page,
     size_t page_read_bytes = bytes_to_read < PGSIZE ? bytes_to_read : PGSIZE;
     size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+    /* Describe this page; page_fault_in() reads it later. */
+    if (!page_add_file(user_page, file, file_offset, page_read_bytes, page_zero_bytes, is_writable))
+      return false;
+#else
     /* Get a page of memory. */
     uint8_t *kernel_page = palloc_get_page(PAL_USER);
     if (kernel_page == NULL)
@@ -543,10 +589,12 @@ load_segment(struct file *file, off_t file_offset, uint8_t *user_page,
       palloc_free_page(kernel_page);
       return false;
     }
+#endif
 
     /* Advance. */
     bytes_to_read -= page_read_bytes;
     zero_bytes -= page_zero_bytes;
+    file_offset += page_read_bytes;
     user_page += PGSIZE;
   }
   return true;
@@ -557,6 +605,16 @@ load_segment(struct file *file, off_t file_offset, uint8_t *user_page,
 static bool
 setup_stack(void **esp)
 {
+#ifdef VM
+  uint8_t *upage = ((uint8_t *)PHYS_BASE) - PGSIZE;
+
+  /* The stack page is evictable like any other, so it goes
+     through the supplemental page table and is faulted in now. */
+  if (!page_add_zero(upage, true) || !page_fault_in(upage, PHYS_BASE))
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -570,8 +628,10 @@ setup_stack(void **esp)
       palloc_free_page(kpage);
   }
   return success;
+#endif
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -590,6 +650,7 @@ install_page(void *upage, void *kpage, bool writable)
      address, then map our page there. */
   return (pagedir_get_page(t->pagedir, upage) == NULL && pagedir_set_page(t->pagedir, upage, kpage, writable));
 }
+#endif
 
 /* Setup stack at ESP with ARGC arguments from ARGS array. */
 static void
@@ -633,3 +694,68 @@ pushing_arguments_to_the_stack(char **argument_strings, int argument_count, void
   *stack_pointer -= 4;
   *(int *)*stack_pointer = 0;
 }
+
+/* Gives FILE the lowest free file descriptor in the current
+   process, growing the descriptor table as needed, and returns
+   it.  Returns -1 if the process already has fd_limit
+   descriptors or memory is exhausted. */
+int process_add_file(struct file *file)
+{
+  struct thread *t = thread_current();
+  int fd;
+
+  for (fd = t->free_fd; fd < t->file_cnt; fd++)
+    if (t->files[fd] == NULL)
+      break;
+  if (fd >= fd_limit)
+    return -1;
+
+  if (fd >= t->file_cnt)
+  {
+    int new_cnt = t->file_cnt == 0 ? 16 : t->file_cnt * 2;
+    struct file **new_files;
+
+    if (new_cnt > fd_limit)
+      new_cnt = fd_limit;
+    new_files = realloc(t->files, new_cnt * sizeof *new_files);
+    if (new_files == NULL)
+      return -1;
+    memset(new_files + t->file_cnt, 0, (new_cnt - t->file_cnt) * sizeof *new_files);
+    t->files = new_files;
+    t->file_cnt = new_cnt;
+  }
+
+  t->files[fd] = file;
+  t->free_fd = fd + 1;
+  return fd;
+}
+
+/* Returns the file open as FD in the current process, or NULL if
+   FD is not open. */
+struct file *
+process_get_file(int fd)
+{
+  struct thread *t = thread_current();
+
+  if (fd < FD_MIN || fd >= t->file_cnt)
+    return NULL;
+  return t->files[fd];
+}
+
+/* Frees file descriptor FD in the current process and returns the
+   file it referred to, or NULL if FD is not open.  The caller
+   should close the file. */
+struct file *
+process_remove_file(int fd)
+{
+  struct thread *t = thread_current();
+  struct file *file = process_get_file(fd);
+
+  if (file != NULL)
+  {
+    t->files[fd] = NULL;
+    if (fd < t->free_fd)
+      t->free_fd = fd;
+  }
+  return file;
+}
@@ -10,6 +10,7 @@ struct process_control_block {
   pid_t pid;                              /* Process ID, same as thread ID. */
   struct list_elem elem;                  /* List element for child processes list. */
   char *command;                          /* Command running in process. */
+  struct dir *cwd;                        /* Parent's working directory, until loaded. */
 
   bool waiting;                           /* Is process being waited on. */
   bool exited;                            /* Has process exited. */
@@ -19,15 +20,25 @@ struct process_control_block {
   struct semaphore initialization_sema;   /* Semaphore to synchronize process initialization. */
 };
 
-struct file_desc {
-  int id;                 /* fd value. */
-  struct list_elem elem;  /* List element for open files list. */
-  struct file *file;      /* File. */
-};
+/* Lowest file descriptor handed out for files.
+   0 and 1 are the console. */
+#define FD_MIN 2
+
+/* Default limit on file descriptors per process. */
+#define FD_LIMIT 1024
+
+/* Maximum number of file descriptors a process may hold; a new
+   descriptor must be less than this.  Set by the -fl kernel
+   command-line option, like RLIMIT_NOFILE. */
+extern int fd_limit;
 
 pid_t process_execute (const char *file_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
 
+int process_add_file (struct file *);
+struct file *process_get_file (int fd);
+struct file *process_remove_file (int fd);
+
 #endif /* userprog/process.h */
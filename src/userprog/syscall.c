@@ -1,24 +1,31 @@
 #include "userprog/syscall.h"
 #include "userprog/process.h"
+#include "userprog/uaccess.h"
 #include "devices/shutdown.h"
+#include "devices/tty.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
+#include "filesys/inode.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#ifdef VM
+#include "vm/mmap.h"
+#endif
 
 static void syscall_handler(struct intr_frame *);
 
 static void handle_invalid_access(void);
-static struct file_desc *find_file_desc(int fd);
-static bool put_user(uint8_t *udst, uint8_t byte);
-static int get_user(const uint8_t *uaddr);
-static int mem_read(void *src, void *dest, size_t bytes);
-static void read_from_stack(struct intr_frame *f, void *dest, int ind);
+static char *copy_in_string(const char *ustr);
+static int read_stdin(void *buffer, unsigned size);
+static void read_from_stack(struct intr_frame *f, void *dest, int ind, int cnt);
 
 void sys_halt(void);
 void sys_exit(int status);
@@ -33,119 +40,333 @@ int sys_write(int fd, const void *buffer, unsigned size);
 void sys_seek(int fd, unsigned position);
 unsigned sys_tell(int fd);
 void sys_close(int fd);
-
-struct lock filesys_lock;
+bool sys_chdir(const char *dir);
+bool sys_mkdir(const char *dir);
+bool sys_readdir(int fd, char *name);
+bool sys_isdir(int fd);
+int sys_inumber(int fd);
+int sys_ttymode(int mode, int vmin, int vtime);
+#ifdef VM
+mapid_t sys_mmap(int fd, void *addr);
+void sys_munmap(mapid_t mapping);
+#endif
+
+/* Most bytes of a user buffer that sys_read() or sys_write() pins
+   at once. */
+#define IO_WINDOW (16 * PGSIZE)
+
+/* Most arguments any system call takes. */
+#define SYSCALL_MAX_ARGS 3
+
+/* Latency histogram buckets.  Bucket I counts calls that took
+   from 2**I up to 2**(I + 1) cycles; the last also counts
+   anything slower. */
+#define LATENCY_BUCKETS 32
+
+/* Carries out a system call on its arguments ARGS and returns
+   the value for the caller's EAX. */
+typedef uint32_t syscall_func(const uint32_t *args);
+
+/* What a system call returns, and how it reports failure. */
+enum syscall_result
+{
+  RESULT_VOID,  /* Nothing. */
+  RESULT_VALUE, /* A value that never means failure. */
+  RESULT_INT,   /* An integer, -1 on failure. */
+  RESULT_BOOL   /* A boolean, false on failure. */
+};
+
+/* A system call table entry. */
+struct syscall
+{
+  const char *name;           /* Name, for statistics. */
+  syscall_func *func;         /* Implementation. */
+  int arg_cnt;                /* Number of arguments. */
+  enum syscall_result result; /* Return value. */
+
+  /* Statistics.  Updated with interrupts off. */
+  unsigned call_cnt;                  /* Times called. */
+  unsigned error_cnt;                 /* Times failed. */
+  unsigned latency[LATENCY_BUCKETS];  /* Latency histogram. */
+};
+
+static syscall_func call_halt, call_exit, call_exec, call_wait, call_create,
+    call_remove, call_open, call_filesize, call_read, call_write, call_seek,
+    call_tell, call_close, call_chdir, call_mkdir, call_readdir, call_isdir,
+    call_inumber, call_ttymode;
+#ifdef VM
+static syscall_func call_mmap, call_munmap;
+#endif
+
+/* System calls, indexed by number. */
+static struct syscall syscalls[] = {
+    [SYS_HALT] = {"halt", call_halt, 0, RESULT_VOID},
+    [SYS_EXIT] = {"exit", call_exit, 1, RESULT_VOID},
+    [SYS_EXEC] = {"exec", call_exec, 1, RESULT_INT},
+    [SYS_WAIT] = {"wait", call_wait, 1, RESULT_INT},
+    [SYS_CREATE] = {"create", call_create, 2, RESULT_BOOL},
+    [SYS_REMOVE] = {"remove", call_remove, 1, RESULT_BOOL},
+    [SYS_OPEN] = {"open", call_open, 1, RESULT_INT},
+    [SYS_FILESIZE] = {"filesize", call_filesize, 1, RESULT_INT},
+    [SYS_READ] = {"read", call_read, 3, RESULT_INT},
+    [SYS_WRITE] = {"write", call_write, 3, RESULT_INT},
+    [SYS_SEEK] = {"seek", call_seek, 2, RESULT_VOID},
+    [SYS_TELL] = {"tell", call_tell, 1, RESULT_VALUE},
+    [SYS_CLOSE] = {"close", call_close, 1, RESULT_VOID},
+#ifdef VM
+    [SYS_MMAP] = {"mmap", call_mmap, 2, RESULT_INT},
+    [SYS_MUNMAP] = {"munmap", call_munmap, 1, RESULT_VOID},
+#endif
+    [SYS_CHDIR] = {"chdir", call_chdir, 1, RESULT_BOOL},
+    [SYS_MKDIR] = {"mkdir", call_mkdir, 1, RESULT_BOOL},
+    [SYS_READDIR] = {"readdir", call_readdir, 2, RESULT_BOOL},
+    [SYS_ISDIR] = {"isdir", call_isdir, 1, RESULT_BOOL},
+    [SYS_INUMBER] = {"inumber", call_inumber, 1, RESULT_INT},
+    [SYS_TTYMODE] = {"ttymode", call_ttymode, 3, RESULT_INT},
+};
+
+#define SYSCALL_CNT ((int)(sizeof syscalls / sizeof *syscalls))
+
+static void count_call(struct syscall *sc);
+static void record_latency(struct syscall *sc, uint32_t result, uint64_t cycles);
+static inline uint64_t read_tsc(void);
 
 void syscall_init(void)
 {
   intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
-  lock_init(&filesys_lock);
 }
 
+/* Looks up the system call requested by the user program in the
+   syscalls table, fetches all of its arguments in one copy and
+   runs it, keeping statistics. */
 static void
 syscall_handler(struct intr_frame *frame)
 {
+  uint32_t args[SYSCALL_MAX_ARGS];
   int syscall_number;
+  struct syscall *sc;
+  uint64_t start;
+  uint32_t result;
 
-  /* Get system call number */
-  read_from_stack(frame, &syscall_number, 0);
+#ifdef VM
+  /* Page faults taken on user memory during the call need it to
+     recognize stack accesses. */
+  thread_current()->user_esp = frame->esp;
+#endif
 
-  if (syscall_number == SYS_HALT)
-  {
-    sys_halt();
-  }
-  else if (syscall_number == SYS_EXIT)
-  {
-    int exit_code;
-    read_from_stack(frame, &exit_code, 1);
-    sys_exit(exit_code);
-    NOT_REACHED();
-  }
-  else if (syscall_number == SYS_EXEC)
-  {
-    void *command_line;
-    read_from_stack(frame, &command_line, 1);
-    frame->eax = (uint32_t)sys_exec((const char *)command_line);
-  }
-  else if (syscall_number == SYS_WAIT)
-  {
-    pid_t child_pid;
-    read_from_stack(frame, &child_pid, 1);
-    frame->eax = (uint32_t)sys_wait(child_pid);
-  }
-  else if (syscall_number == SYS_CREATE)
-  {
-    char *file_name;
-    unsigned initial_size;
-    read_from_stack(frame, &file_name, 1);
-    read_from_stack(frame, &initial_size, 2);
-    frame->eax = (uint32_t)sys_create(file_name, initial_size);
-  }
-  else if (syscall_number == SYS_REMOVE)
-  {
-    char *file_name;
-    read_from_stack(frame, &file_name, 1);
-    frame->eax = (uint32_t)sys_remove(file_name);
-  }
-  else if (syscall_number == SYS_OPEN)
-  {
-    char *file_name;
-    read_from_stack(frame, &file_name, 1);
-    frame->eax = (uint32_t)sys_open(file_name);
-  }
-  else if (syscall_number == SYS_FILESIZE)
-  {
-    int file_descriptor;
-    read_from_stack(frame, &file_descriptor, 1);
-    frame->eax = (uint32_t)sys_filesize(file_descriptor);
-  }
-  else if (syscall_number == SYS_READ)
-  {
-    int file_descriptor;
-    void *buffer;
-    unsigned size;
-    read_from_stack(frame, &file_descriptor, 1);
-    read_from_stack(frame, &buffer, 2);
-    read_from_stack(frame, &size, 3);
-    frame->eax = (uint32_t)sys_read(file_descriptor, buffer, size);
-  }
-  else if (syscall_number == SYS_WRITE)
-  {
-    int file_descriptor, return_code;
-    void *buffer;
-    unsigned int size;
-    read_from_stack(frame, &file_descriptor, 1);
-    read_from_stack(frame, &buffer, 2);
-    read_from_stack(frame, &size, 3);
-    frame->eax = (uint32_t)sys_write(file_descriptor, buffer, size);
-  }
-  else if (syscall_number == SYS_SEEK)
-  {
-    int file_descriptor;
-    unsigned position;
-    read_from_stack(frame, &file_descriptor, 1);
-    read_from_stack(frame, &position, 2);
-    sys_seek(file_descriptor, position);
-  }
-  else if (syscall_number == SYS_TELL)
-  {
-    int file_descriptor;
-    read_from_stack(frame, &file_descriptor, 1);
-    frame->eax = (uint32_t)sys_tell(file_descriptor);
-  }
-  else if (syscall_number == SYS_CLOSE)
-  {
-    int file_descriptor;
-    read_from_stack(frame, &file_descriptor, 1);
-    sys_close(file_descriptor);
-  }
-  else
+  /* Get system call number */
+  read_from_stack(frame, &syscall_number, 0, 1);
+  if (syscall_number < 0 || syscall_number >= SYSCALL_CNT || syscalls[syscall_number].func == NULL)
   {
     printf("[ERROR]: system call %d is unimplemented\n", syscall_number);
     sys_exit(-1);
   }
+  sc = &syscalls[syscall_number];
+  read_from_stack(frame, args, 1, sc->arg_cnt);
+
+  /* Calls that do not return, like exit, are counted here but
+     contribute no latency. */
+  count_call(sc);
+  start = read_tsc();
+  result = sc->func(args);
+  record_latency(sc, result, read_tsc() - start);
+
+  if (sc->result != RESULT_VOID)
+    frame->eax = result;
+}
+
+/* Prints statistics for each system call that has been made. */
+void syscall_print_stats(void)
+{
+  int i, bucket;
+
+  for (i = 0; i < SYSCALL_CNT; i++)
+  {
+    const struct syscall *sc = &syscalls[i];
+
+    if (sc->call_cnt == 0)
+      continue;
+    printf("Syscall %s: %u calls, %u errors\n", sc->name, sc->call_cnt, sc->error_cnt);
+    printf("  cycles (log2: count):");
+    for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+      if (sc->latency[bucket] > 0)
+        printf(" %d: %u", bucket, sc->latency[bucket]);
+    printf("\n");
+  }
+}
+
+/* Counts a call to SC that is just starting. */
+static void
+count_call(struct syscall *sc)
+{
+  enum intr_level old_level = intr_disable();
+  sc->call_cnt++;
+  intr_set_level(old_level);
+}
+
+/* Accounts for a call to SC that returned RESULT after CYCLES
+   cycles. */
+static void
+record_latency(struct syscall *sc, uint32_t result, uint64_t cycles)
+{
+  enum intr_level old_level = intr_disable();
+  int bucket = 0;
+
+  while (bucket < LATENCY_BUCKETS - 1 && cycles >> (bucket + 1) != 0)
+    bucket++;
+  sc->latency[bucket]++;
+
+  if ((sc->result == RESULT_INT && result == (uint32_t)-1) || (sc->result == RESULT_BOOL && result == 0))
+    sc->error_cnt++;
+  intr_set_level(old_level);
+}
+
+/* Returns the CPU's time-stamp counter, which counts cycles. */
+static inline uint64_t
+read_tsc(void)
+{
+  uint64_t tsc;
+  asm volatile("rdtsc"
+               : "=A"(tsc));
+  return tsc;
+}
+
+/* Adapters from syscalls table entries to the sys_*()
+   functions, which take their arguments as C types. */
+
+static uint32_t
+call_halt(const uint32_t *args UNUSED)
+{
+  sys_halt();
+  NOT_REACHED();
+}
+
+static uint32_t
+call_exit(const uint32_t *args)
+{
+  sys_exit((int)args[0]);
+  NOT_REACHED();
+}
+
+static uint32_t
+call_exec(const uint32_t *args)
+{
+  return (uint32_t)sys_exec((const char *)args[0]);
+}
+
+static uint32_t
+call_wait(const uint32_t *args)
+{
+  return (uint32_t)sys_wait((pid_t)args[0]);
+}
+
+static uint32_t
+call_create(const uint32_t *args)
+{
+  return (uint32_t)sys_create((const char *)args[0], (unsigned)args[1]);
+}
+
+static uint32_t
+call_remove(const uint32_t *args)
+{
+  return (uint32_t)sys_remove((const char *)args[0]);
+}
+
+static uint32_t
+call_open(const uint32_t *args)
+{
+  return (uint32_t)sys_open((const char *)args[0]);
+}
+
+static uint32_t
+call_filesize(const uint32_t *args)
+{
+  return (uint32_t)sys_filesize((int)args[0]);
+}
+
+static uint32_t
+call_read(const uint32_t *args)
+{
+  return (uint32_t)sys_read((int)args[0], (void *)args[1], (unsigned)args[2]);
+}
+
+static uint32_t
+call_write(const uint32_t *args)
+{
+  return (uint32_t)sys_write((int)args[0], (const void *)args[1], (unsigned)args[2]);
+}
+
+static uint32_t
+call_seek(const uint32_t *args)
+{
+  sys_seek((int)args[0], (unsigned)args[1]);
+  return 0;
+}
+
+static uint32_t
+call_tell(const uint32_t *args)
+{
+  return (uint32_t)sys_tell((int)args[0]);
+}
+
+static uint32_t
+call_close(const uint32_t *args)
+{
+  sys_close((int)args[0]);
+  return 0;
+}
+
+static uint32_t
+call_chdir(const uint32_t *args)
+{
+  return (uint32_t)sys_chdir((const char *)args[0]);
+}
+
+static uint32_t
+call_mkdir(const uint32_t *args)
+{
+  return (uint32_t)sys_mkdir((const char *)args[0]);
+}
+
+static uint32_t
+call_readdir(const uint32_t *args)
+{
+  return (uint32_t)sys_readdir((int)args[0], (char *)args[1]);
+}
+
+static uint32_t
+call_isdir(const uint32_t *args)
+{
+  return (uint32_t)sys_isdir((int)args[0]);
+}
+
+static uint32_t
+call_inumber(const uint32_t *args)
+{
+  return (uint32_t)sys_inumber((int)args[0]);
+}
+
+static uint32_t
+call_ttymode(const uint32_t *args)
+{
+  return (uint32_t)sys_ttymode((int)args[0], (int)args[1], (int)args[2]);
+}
+
+#ifdef VM
+static uint32_t
+call_mmap(const uint32_t *args)
+{
+  return (uint32_t)sys_mmap((int)args[0], (void *)args[1]);
 }
 
+static uint32_t
+call_munmap(const uint32_t *args)
+{
+  sys_munmap((mapid_t)args[0]);
+  return 0;
+}
+#endif
+
 void sys_halt(void)
 {
   shutdown_power_off();
@@ -155,8 +376,6 @@ void sys_halt(void)
 static void
 handle_invalid_access(void)
 {
-  if (lock_held_by_current_thread(&filesys_lock))
-    lock_release(&filesys_lock);
   sys_exit(-1);
   NOT_REACHED();
 }
@@ -177,27 +396,12 @@ void sys_exit(int status)
 
 pid_t sys_exec(const char *command_line)
 {
-  if (get_user((const uint8_t *)command_line) == -1)
-    handle_invalid_access();
-
-  /* Check validity of command_line string */
-  int i = 0;
-  for (int i = 0;; i++)
-  {
-    char temp = get_user((const uint8_t *)(command_line + i));
-    if (temp == -1) /* Invalid memory */
-    {
-      handle_invalid_access();
-    }
-    else if (temp == 0) /* Null terminator */
-    {
-      break;
-    }
-  }
+  char *kernel_command_line = copy_in_string(command_line);
+  if (kernel_command_line == NULL)
+    return -1;
 
-  lock_acquire(&filesys_lock);
-  pid_t process_id = process_execute(command_line);
-  lock_release(&filesys_lock);
+  pid_t process_id = process_execute(kernel_command_line);
+  palloc_free_page(kernel_command_line);
   return process_id;
 }
 
@@ -208,257 +412,336 @@ int sys_wait(pid_t pid)
 
 bool sys_create(const char *new_filename, unsigned initial_size)
 {
-  if (get_user(new_filename) == -1)
-    handle_invalid_access();
+  char *filename = copy_in_string(new_filename);
+  if (filename == NULL)
+    return false;
 
-  lock_acquire(&filesys_lock);
-  bool result_by_filesys_create_function = filesys_create(new_filename, initial_size);
-  lock_release(&filesys_lock);
+  bool result_by_filesys_create_function = filesys_create(filename, initial_size);
+  palloc_free_page(filename);
   return result_by_filesys_create_function;
 }
 
-bool sys_remove(const char *filename)
+bool sys_remove(const char *user_filename)
 {
-  if (get_user(filename) == -1)
-    handle_invalid_access();
+  char *filename = copy_in_string(user_filename);
+  if (filename == NULL)
+    return false;
 
-  lock_acquire(&filesys_lock);
   bool return_value_by_filesys_remove_function = filesys_remove(filename);
-  lock_release(&filesys_lock);
+  palloc_free_page(filename);
   return return_value_by_filesys_remove_function;
 }
 
 int sys_open(const char *new_filename)
 {
   struct file *opened_file;
-  struct file_desc *file_descriptor;
-  if (get_user(new_filename) == -1)
-    handle_invalid_access();
+  int fd;
+  char *filename = copy_in_string(new_filename);
+  if (filename == NULL)
+    return -1;
 
-  lock_acquire(&filesys_lock);
-  opened_file = filesys_open(new_filename);
+  opened_file = filesys_open(filename);
+  palloc_free_page(filename);
   if (!opened_file)
-  {
-    lock_release(&filesys_lock);
     return -1;
-  }
 
-  file_descriptor = malloc(sizeof(*file_descriptor));
-  file_descriptor->file = opened_file;
-  struct list *files_list = &thread_current()->file_descriptors;
-  if (list_empty(files_list))
-    file_descriptor->id = 2; /* 0=STDIN, 1=STDOUT */
-  else
-    file_descriptor->id = list_entry(list_back(files_list), struct file_desc, elem)->id + 1;
-  list_push_back(files_list, &file_descriptor->elem);
-  lock_release(&filesys_lock);
+  fd = process_add_file(opened_file);
+  if (fd == -1)
+    file_close(opened_file);
 
-  return file_descriptor->id;
+  return fd;
 }
 
 int sys_filesize(int file_descriptor)
 {
-  struct file_desc *file_desc = find_file_desc(file_descriptor);
+  struct file *file = process_get_file(file_descriptor);
 
-  if (file_desc == NULL)
+  if (file == NULL)
     return -1;
 
-  lock_acquire(&filesys_lock);
-  int length = file_length(file_desc->file);
-  lock_release(&filesys_lock);
-  return length;
+  return file_length(file);
 }
 
+/* Reads up to READ_SIZE bytes from FILE_DESCRIPTOR into the user
+   buffer READ_BUFFER.  A read from STDIN returns what the
+   console's line discipline delivers at once, normally one line.
+   Returns the number of bytes read, or -1 if FILE_DESCRIPTOR is
+   not open for reading. */
 int sys_read(int file_descriptor, void *read_buffer, unsigned read_size)
 {
-  if (get_user((const uint8_t *)read_buffer) == -1)
-    handle_invalid_access();
+  if (file_descriptor == 0) // STDIN
+    return read_stdin(read_buffer, read_size);
 
-  if (file_descriptor == 0)
-  { // STDIN
-    for (int i = 0; i < read_size; i++)
-      if (!put_user(read_buffer + i, input_getc()))
-        handle_invalid_access();
-    return read_size;
-  }
-  else
+  struct file *file = process_get_file(file_descriptor);
+  if (file == NULL || inode_is_dir(file_get_inode(file)))
+    return -1;
+
+  /* The file system reads straight into the user's pages, which
+     are pinned a bounded window at a time so that a huge read
+     cannot tie up all of memory. */
+  unsigned bytes_read = 0;
+  while (bytes_read < read_size)
   {
-    lock_acquire(&filesys_lock);
-    struct file_desc *file_desc = find_file_desc(file_descriptor);
+    uint8_t *window = (uint8_t *)read_buffer + bytes_read;
+    unsigned window_size = IO_WINDOW - pg_ofs(window);
+    off_t window_read;
 
-    if (file_desc && file_desc->file)
-    {
-      off_t bytes_read = file_read(file_desc->file, read_buffer, read_size);
-      lock_release(&filesys_lock);
-      return bytes_read;
-    }
-    else
-    {
-      lock_release(&filesys_lock);
-      return -1;
-    }
+    if (window_size > read_size - bytes_read)
+      window_size = read_size - bytes_read;
+    if (!pin_user_buffer(window, window_size, true))
+      handle_invalid_access();
+    window_read = file_read(file, window, window_size);
+    unpin_user_buffer(window, window_size);
+
+    bytes_read += window_read;
+    if ((unsigned)window_read < window_size)
+      break;
   }
+  return bytes_read;
 }
 
+/* Writes SIZE bytes from the user buffer BUFFER to FD.  Returns
+   the number of bytes written, or -1 if FD is not open for
+   writing, as a directory is not. */
 int sys_write(int fd, const void *buffer, unsigned size)
 {
-  if (get_user((const uint8_t *)buffer) == -1)
-    handle_invalid_access();
+  struct file *file = NULL;
+  unsigned bytes_written = 0;
 
-  if (fd == 1)
+  if (fd != 1) // Not STDOUT
   {
-    putbuf((const char *)buffer, size);
-    return size;
+    file = process_get_file(fd);
+    if (file == NULL || inode_is_dir(file_get_inode(file)))
+      return -1;
   }
-  else
+
+  /* Written straight from the user's pages, pinned a window at a
+     time, as sys_read() reads into them. */
+  while (bytes_written < size)
   {
-    lock_acquire(&filesys_lock);
-    struct file_desc *f_desc = find_file_desc(fd);
+    const uint8_t *window = (const uint8_t *)buffer + bytes_written;
+    unsigned window_size = IO_WINDOW - pg_ofs(window);
+    unsigned window_written;
 
-    if (f_desc && f_desc->file)
+    if (window_size > size - bytes_written)
+      window_size = size - bytes_written;
+    if (!pin_user_buffer(window, window_size, false))
+      handle_invalid_access();
+    if (file == NULL)
     {
-      off_t bytes_written = file_write(f_desc->file, buffer, size);
-      lock_release(&filesys_lock);
-      return bytes_written;
+      putbuf((const char *)window, window_size);
+      window_written = window_size;
     }
     else
-    {
-      lock_release(&filesys_lock);
-      return -1;
-    }
+      window_written = file_write(file, window, window_size);
+    unpin_user_buffer(window, window_size);
+
+    bytes_written += window_written;
+    if (window_written < window_size)
+      break;
   }
+  return bytes_written;
 }
 
 void sys_seek(int fd, unsigned position)
 {
-  lock_acquire(&filesys_lock);
-  struct file_desc *f_desc = find_file_desc(fd);
+  struct file *file = process_get_file(fd);
 
-  if (f_desc && f_desc->file)
-  {
-    file_seek(f_desc->file, position);
-    lock_release(&filesys_lock);
-  }
-  else
-  {
-    lock_release(&filesys_lock);
+  if (file == NULL)
     sys_exit(-1);
-  }
+  file_seek(file, position);
 }
 
 unsigned
 sys_tell(int fd)
 {
-  lock_acquire(&filesys_lock);
-  struct file_desc *f_desc = find_file_desc(fd);
+  struct file *file = process_get_file(fd);
 
-  if (f_desc && f_desc->file)
-  {
-    off_t pos = file_tell(f_desc->file);
-    lock_release(&filesys_lock);
-    return pos;
-  }
-  else
-  {
-    lock_release(&filesys_lock);
+  if (file == NULL)
     sys_exit(-1);
-  }
+  return file_tell(file);
 }
 
 void sys_close(int fd)
 {
-  lock_acquire(&filesys_lock);
-  struct file_desc *f_desc = find_file_desc(fd);
+  file_close(process_remove_file(fd));
+}
 
-  if (f_desc && f_desc->file)
-  {
-    file_close(f_desc->file);
-    list_remove(&f_desc->elem);
-    free(f_desc);
-  }
-  lock_release(&filesys_lock);
+/* Changes the current working directory to DIR, which may be
+   relative or absolute.  Returns true if successful. */
+bool sys_chdir(const char *user_dir)
+{
+  char *dir = copy_in_string(user_dir);
+  bool success;
+
+  if (dir == NULL)
+    return false;
+  success = filesys_chdir(dir);
+  palloc_free_page(dir);
+  return success;
 }
 
-static struct file_desc *
-find_file_desc(int file_descriptor)
+/* Creates the directory named DIR, which must not exist already.
+   Returns true if successful. */
+bool sys_mkdir(const char *user_dir)
 {
-  if (file_descriptor < 2)
-    return NULL;
+  char *dir = copy_in_string(user_dir);
+  bool success;
 
-  struct thread *current_thread = thread_current();
+  if (dir == NULL)
+    return false;
+  success = filesys_mkdir(dir);
+  palloc_free_page(dir);
+  return success;
+}
 
-  if (list_empty(&current_thread->file_descriptors))
-    return NULL;
+/* Reads the next entry, other than "." and "..", from the
+   directory open as FD and stores its name in the user buffer
+   NAME, which must have room for READDIR_MAX_LEN + 1 bytes.
+   Returns true if successful, false if FD is not a directory or
+   has no more entries. */
+bool sys_readdir(int fd, char *name)
+{
+  struct file *file = process_get_file(fd);
+  char entry[NAME_MAX + 1];
+  off_t pos;
+  bool found;
 
-  struct list_elem *element;
-  struct file_desc *found_descriptor = NULL;
-  for (element = list_begin(&current_thread->file_descriptors); element != list_end(&current_thread->file_descriptors);
-       element = list_next(element))
-  {
-    struct file_desc *f_desc =
-        list_entry(element, struct file_desc, elem);
-    if (f_desc->id == file_descriptor)
-    {
-      found_descriptor = f_desc;
-      break;
-    }
-  }
-  return found_descriptor;
+  if (file == NULL || !inode_is_dir(file_get_inode(file)))
+    return false;
+
+  /* The file's position is the position in the directory. */
+  pos = file_tell(file);
+  found = dir_readdir_at(file_get_inode(file), &pos, entry);
+  file_seek(file, pos);
+
+  if (found && copy_to_user(name, entry, strlen(entry) + 1) != strlen(entry) + 1)
+    handle_invalid_access();
+  return found;
 }
 
-/* Read IND argument from stack pointer in F and store at DEST. */
-static void
-read_from_stack(struct intr_frame *f, void *dest, int ind)
+/* Returns true if FD is open on a directory. */
+bool sys_isdir(int fd)
+{
+  struct file *file = process_get_file(fd);
+
+  return file != NULL && inode_is_dir(file_get_inode(file));
+}
+
+/* Returns the inode number of the file or directory open as FD,
+   or -1 if FD is not open. */
+int sys_inumber(int fd)
+{
+  struct file *file = process_get_file(fd);
+
+  if (file == NULL)
+    return -1;
+  return inode_get_inumber(file_get_inode(file));
+}
+
+/* Sets how console input is read: as whole edited lines if MODE
+   has TTY_CANONICAL, otherwise byte by byte as governed by VMIN
+   and VTIME, with echo if MODE has TTY_ECHO.  See tty_read().
+   Returns the mode bits in effect before, or -1 if MODE, VMIN or
+   VTIME is out of range. */
+int sys_ttymode(int mode, int vmin, int vtime)
+{
+  struct tty_mode old, new;
+
+  if ((mode & ~(TTY_CANONICAL | TTY_ECHO)) != 0 || vmin < 0 || vmin > UINT8_MAX || vtime < 0 || vtime > UINT8_MAX)
+    return -1;
+
+  tty_get_mode(&old);
+  new.canonical = (mode & TTY_CANONICAL) != 0;
+  new.echo = (mode & TTY_ECHO) != 0;
+  new.vmin = vmin;
+  new.vtime = vtime;
+  tty_set_mode(&new);
+
+  return (old.canonical ? TTY_CANONICAL : 0) | (old.echo ? TTY_ECHO : 0);
+}
+
+#ifdef VM
+/* Maps the file open as FD into memory at ADDR.
+   Returns the mapping's identifier, or MAP_FAILED. */
+mapid_t sys_mmap(int fd, void *addr)
+{
+  struct file *mapped_file = NULL;
+
+  /* The mapping gets its own handle, so it survives close(FD). */
+  struct file *file = process_get_file(fd);
+  if (file != NULL)
+    mapped_file = file_reopen(file);
+
+  if (mapped_file == NULL)
+    return MAP_FAILED;
+  return mmap_map(mapped_file, addr);
+}
+
+/* Unmaps MAPPING, writing modified pages back to the file. */
+void sys_munmap(mapid_t mapping)
 {
-  mem_read(f->esp + ind * 4, dest, 4);
+  mmap_unmap(mapping);
 }
+#endif
 
-/* Reads BYTES bytes at SRC and stores at DEST.
-   Returns number of bytes read if successful, -1 if a
-   segfault occurred. */
+/* Reads console input into the user buffer BUFFER, as sys_read()
+   does for STDIN. */
 static int
-mem_read(void *src, void *dest, size_t count)
+read_stdin(void *buffer, unsigned size)
 {
-  int32_t value;
-  for (size_t i = 0; i < count; i++)
+  uint8_t *kernel_buffer;
+  size_t bytes_read;
+
+  kernel_buffer = palloc_get_page(0);
+  if (kernel_buffer == NULL)
+    return -1;
+
+  bytes_read = tty_read(kernel_buffer, size < PGSIZE ? size : PGSIZE);
+  if (copy_to_user(buffer, kernel_buffer, bytes_read) != bytes_read)
   {
-    value = get_user(src + i);
-    if (value == -1)
-      handle_invalid_access();
-    *(char *)(dest + i) = value;
+    palloc_free_page(kernel_buffer);
+    handle_invalid_access();
   }
-  return (int)count;
+  palloc_free_page(kernel_buffer);
+  return bytes_read;
 }
 
-/* Reads a byte at user virtual address UADDR.
-   UADDR must be below PHYS_BASE.
-   Returns the byte value if successful, -1 if a segfault
-   occurred. */
-static int
-get_user(const uint8_t *uaddr)
+/* Copies the null-terminated string at user address USTR into a
+   newly allocated page, which the caller must free.  Returns a
+   null pointer if the string does not fit in a page or no page is
+   free.  Terminates the process if USTR is not a valid string. */
+static char *
+copy_in_string(const char *ustr)
 {
-  if ((void *)uaddr >= PHYS_BASE)
-    return -1;
+  char *kernel_string = palloc_get_page(0);
+  int length;
 
-  int result;
-  asm("movl $1f, %0; movzbl %1, %0; 1:"
-      : "=&a"(result)
-      : "m"(*uaddr));
-  return result;
+  if (kernel_string == NULL)
+    return NULL;
+
+  length = strncpy_from_user(kernel_string, ustr, PGSIZE);
+  if (length < 0)
+  {
+    palloc_free_page(kernel_string);
+    handle_invalid_access();
+  }
+  if (length == PGSIZE)
+  {
+    palloc_free_page(kernel_string);
+    return NULL;
+  }
+  return kernel_string;
 }
 
-/* Writes BYTE to user address UDST.
-   UDST must be below PHYS_BASE.
-   Returns true if successful, false if a segfault occurred. */
-static bool
-put_user(uint8_t *udst, uint8_t byte)
+/* Copies CNT 32-bit words from the user stack in F, starting IND
+   words above the stack pointer, to DEST.  Terminates the process
+   if they are not all in user memory. */
+static void
+read_from_stack(struct intr_frame *f, void *dest, int ind, int cnt)
 {
-  if ((void *)udst >= PHYS_BASE)
-    return false;
+  size_t size = cnt * sizeof(uint32_t);
 
-  int error_code;
-  asm("movl $1f, %0; movb %b2, %1; 1:"
-      : "=&a"(error_code), "=m"(*udst)
-      : "q"(byte));
-  return error_code != -1;
+  if (copy_from_user(dest, (uint32_t *)f->esp + ind, size) != size)
+    handle_invalid_access();
 }
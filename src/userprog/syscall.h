@@ -1,7 +1,10 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include "threads/synch.h"
+
 void syscall_init (void);
+void syscall_print_stats (void);
 
 void sys_exit (int status);
 
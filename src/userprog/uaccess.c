@@ -0,0 +1,172 @@
+#include "userprog/uaccess.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
+
+/* User memory is accessed in place, through the current process's
+   page directory.  When the kernel faults on an address that is
+   not part of the address space, page_fault() resumes execution
+   at the address held in EAX and sets EAX to -1, so each routine
+   below loads the address of its landing pad into EAX and then
+   copies a whole run with no further checks.  A faulting string
+   instruction leaves ECX, ESI and EDI describing the remaining
+   work, so the offset of the fault falls out of ECX. */
+
+static bool is_user_range(const void *uaddr, size_t size);
+static bool pin_page(const void *upage, bool write);
+static void unpin_pages(const uint8_t *start, const uint8_t *end);
+
+/* Copies SIZE bytes from user address USRC to kernel address DST.
+   Returns the number of bytes copied, which is less than SIZE
+   only if the copy faulted at that offset into USRC, or is 0 if
+   the range is not entirely below PHYS_BASE. */
+size_t copy_from_user(void *dst, const void *usrc, size_t size)
+{
+  size_t left = size;
+  int landing_pad;
+
+  if (!is_user_range(usrc, size))
+    return 0;
+
+  asm volatile("movl $1f, %%eax; rep movsb; 1:"
+               : "+c"(left), "+S"(usrc), "+D"(dst), "=&a"(landing_pad)
+               :
+               : "memory");
+  return size - left;
+}
+
+/* Copies SIZE bytes from kernel address SRC to user address UDST.
+   Returns the number of bytes copied, which is less than SIZE
+   only if the copy faulted at that offset into UDST, or is 0 if
+   the range is not entirely below PHYS_BASE. */
+size_t copy_to_user(void *udst, const void *src, size_t size)
+{
+  size_t left = size;
+  int landing_pad;
+
+  if (!is_user_range(udst, size))
+    return 0;
+
+  asm volatile("movl $1f, %%eax; rep movsb; 1:"
+               : "+c"(left), "+S"(src), "+D"(udst), "=&a"(landing_pad)
+               :
+               : "memory");
+  return size - left;
+}
+
+/* Copies the null-terminated string at user address USRC into
+   DST, which has room for SIZE bytes.  Returns the length of the
+   string, not counting the null terminator, or SIZE if the string
+   does not fit, in which case DST is not null-terminated.
+   Returns -1 if USRC is not a valid user string. */
+int strncpy_from_user(char *dst, const char *usrc, size_t size)
+{
+  size_t limit = size;
+  size_t left;
+  char *end = dst;
+  int landing_pad;
+  char byte;
+
+  /* Never read past the top of user memory. */
+  if ((const void *)usrc >= PHYS_BASE)
+    return -1;
+  if (limit > (size_t)((const char *)PHYS_BASE - usrc))
+    limit = (const char *)PHYS_BASE - usrc;
+
+  left = limit;
+  asm volatile("movl $2f, %%eax\n\t"
+               "1: testl %%ecx, %%ecx\n\t"
+               "jz 2f\n\t"
+               "movb (%%esi), %%dl\n\t"
+               "movb %%dl, (%%edi)\n\t"
+               "incl %%esi\n\t"
+               "incl %%edi\n\t"
+               "decl %%ecx\n\t"
+               "testb %%dl, %%dl\n\t"
+               "jnz 1b\n"
+               "2:"
+               : "+c"(left), "+S"(usrc), "+D"(end), "=&a"(landing_pad), "=&d"(byte)
+               :
+               : "memory", "cc");
+
+  if (landing_pad == -1)
+    return -1;
+  if (end > dst && end[-1] == '\0')
+    return end - dst - 1;
+
+  /* Ran out of room.  If that was because of PHYS_BASE rather
+     than SIZE, the string runs into kernel memory. */
+  return limit == size ? (int)size : -1;
+}
+
+/* Brings the SIZE bytes at user address UADDR into memory and
+   keeps them there, so that code which must not fault, such as
+   the file system, can access them directly.  WRITE requests
+   write access.  Returns false, with nothing left pinned, if the
+   range is not all accessible.  A successful call must be paired
+   with unpin_user_buffer(). */
+bool pin_user_buffer(const void *uaddr, size_t size, bool write)
+{
+  const uint8_t *start = pg_round_down(uaddr);
+  const uint8_t *end = (const uint8_t *)uaddr + size;
+  const uint8_t *upage;
+
+  if (!is_user_range(uaddr, size))
+    return false;
+
+  for (upage = start; upage < end; upage += PGSIZE)
+    if (!pin_page(upage, write))
+    {
+      unpin_pages(start, upage);
+      return false;
+    }
+  return true;
+}
+
+/* Releases the SIZE bytes at UADDR pinned by pin_user_buffer(). */
+void unpin_user_buffer(const void *uaddr, size_t size)
+{
+  unpin_pages(pg_round_down(uaddr), (const uint8_t *)uaddr + size);
+}
+
+/* Pins user page UPAGE for pin_user_buffer().  Without virtual
+   memory every page of a process stays resident, so it only has
+   to be mapped. */
+static bool
+pin_page(const void *upage, bool write)
+{
+#ifdef VM
+  return page_pin(upage, write);
+#else
+  uint32_t *pd = thread_current()->pagedir;
+  return pagedir_get_page(pd, upage) != NULL && (!write || pagedir_is_writable(pd, upage));
+#endif
+}
+
+/* Unpins the user pages from START up to END. */
+static void
+unpin_pages(const uint8_t *start UNUSED, const uint8_t *end UNUSED)
+{
+#ifdef VM
+  const uint8_t *upage;
+
+  for (upage = start; upage < end; upage += PGSIZE)
+    page_unpin(upage);
+#endif
+}
+
+/* Returns true if [UADDR, UADDR + SIZE) lies entirely in user
+   virtual memory. */
+static bool
+is_user_range(const void *uaddr, size_t size)
+{
+  uintptr_t start = (uintptr_t)uaddr;
+
+  return start + size >= start && start + size <= (uintptr_t)PHYS_BASE;
+}
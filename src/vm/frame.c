@@ -0,0 +1,535 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Most frames reclaimed by a single eviction pass.  Dirty pages
+   among them are written to consecutive swap slots, so the
+   cluster reaches the disk as one sequential batch and the
+   surplus frames satisfy the next few allocations. */
+#define EVICT_CLUSTER 8
+
+/* Eviction passes frame_alloc() makes before giving up.  A pass
+   finds nothing when every frame is pinned or its owner is busy,
+   which usually clears up once other threads have run. */
+#define EVICT_TRIES 16
+
+/* A frame of the user pool that holds a user page.  Read-only
+   executable pages are shared, so a frame may be mapped by the
+   same page of several processes. */
+struct frame
+{
+  void *kpage;                 /* Kernel virtual address of the frame. */
+  struct list pages;           /* Pages mapped to it, by frame_elem. */
+  int pin_cnt;                 /* Not to be evicted while nonzero. */
+  struct inode *inode;         /* Executable it caches, or NULL. */
+  off_t offset;                /* Offset in INODE of the cached page. */
+  struct hash_elem hash_elem;  /* Element in frame_map. */
+  struct hash_elem share_elem; /* Element in share_map if INODE is set. */
+  struct list_elem list_elem;  /* Element in frame_list, in clock order. */
+};
+
+static struct lock frame_lock;       /* Protects everything below. */
+static struct hash frame_map;        /* Frames keyed by kernel address. */
+static struct hash share_map;        /* Shared frames keyed by inode, offset. */
+static struct list frame_list;       /* Circular clock list of frames. */
+static struct list_elem *clock_hand; /* Next frame the clock examines. */
+
+static hash_hash_func frame_hash;
+static hash_less_func frame_less;
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
+static struct frame *frame_lookup(void *kpage);
+static bool is_shareable(const struct page *p);
+static void frame_remove(struct frame *f);
+static void *reclaim(struct frame *f, void *kpage);
+static struct frame *clock_advance(void);
+static bool frame_accessed(struct frame *f);
+static void unmap_shared(struct frame *f);
+static void *evict(void);
+
+/* Initializes the frame table. */
+void frame_init(void)
+{
+  lock_init(&frame_lock);
+  list_init(&frame_list);
+  clock_hand = NULL;
+  if (!hash_init(&frame_map, frame_hash, frame_less, NULL) || !hash_init(&share_map, share_hash, share_less, NULL))
+    PANIC("frame table creation failed");
+}
+
+/* Obtains a frame from the user pool to hold PAGE of the current
+   process and returns its kernel virtual address.  If the pool
+   is exhausted and MAY_EVICT is true, pages of some process are
+   evicted to make room, yielding between attempts while every
+   frame is busy.  Returns a null pointer if no frame can be
+   found.
+
+   The frame is returned pinned, so it cannot be evicted before
+   the caller has filled and mapped it; frame_unpin() releases
+   it.  The caller must hold its own spt_lock. */
+void *
+frame_alloc(struct page *page, bool may_evict)
+{
+  struct frame *f;
+  void *kpage;
+  int tries;
+
+  f = malloc(sizeof *f);
+  if (f == NULL)
+    return NULL;
+
+  lock_acquire(&frame_lock);
+  kpage = palloc_get_page(PAL_USER);
+  for (tries = 0; kpage == NULL && may_evict && tries < EVICT_TRIES; tries++)
+  {
+    kpage = evict();
+    if (kpage == NULL)
+    {
+      /* Let the owners of busy frames finish with them. */
+      lock_release(&frame_lock);
+      thread_yield();
+      lock_acquire(&frame_lock);
+      kpage = palloc_get_page(PAL_USER);
+    }
+  }
+  if (kpage == NULL)
+  {
+    lock_release(&frame_lock);
+    free(f);
+    return NULL;
+  }
+
+  f->kpage = kpage;
+  list_init(&f->pages);
+  list_push_back(&f->pages, &page->frame_elem);
+  f->pin_cnt = 1;
+  f->inode = NULL;
+  f->offset = 0;
+  hash_insert(&frame_map, &f->hash_elem);
+
+  /* New frames go just behind the hand so that they are the
+     last ones the clock looks at. */
+  if (clock_hand == NULL || clock_hand == list_end(&frame_list))
+    list_push_back(&frame_list, &f->list_elem);
+  else
+    list_insert(clock_hand, &f->list_elem);
+  lock_release(&frame_lock);
+
+  return kpage;
+}
+
+/* Looks for a frame that already holds read-only executable
+   page PAGE for another process.  If there is one, adds PAGE to
+   its mappings and returns its kernel virtual address, pinned as
+   by frame_alloc(); otherwise returns a null pointer. */
+void *
+frame_share(struct page *page)
+{
+  struct frame key;
+  struct hash_elem *e;
+  struct frame *f;
+  void *kpage = NULL;
+
+  if (!is_shareable(page))
+    return NULL;
+
+  key.inode = file_get_inode(page->file);
+  key.offset = page->file_offset;
+
+  lock_acquire(&frame_lock);
+  e = hash_find(&share_map, &key.share_elem);
+  if (e != NULL)
+  {
+    f = hash_entry(e, struct frame, share_elem);
+    list_push_back(&f->pages, &page->frame_elem);
+    f->pin_cnt++;
+    kpage = f->kpage;
+  }
+  lock_release(&frame_lock);
+
+  return kpage;
+}
+
+/* Offers the frame at KPAGE, which has just been filled from its
+   backing file, to later frame_share() calls if its page is a
+   read-only executable page.  If another process published the
+   same page first, this frame simply stays private. */
+void frame_publish(void *kpage)
+{
+  struct frame *f;
+  struct page *page;
+
+  lock_acquire(&frame_lock);
+  f = frame_lookup(kpage);
+  ASSERT(f != NULL);
+  page = list_entry(list_front(&f->pages), struct page, frame_elem);
+  if (is_shareable(page))
+  {
+    f->inode = file_get_inode(page->file);
+    f->offset = page->file_offset;
+    if (hash_insert(&share_map, &f->share_elem) != NULL)
+      f->inode = NULL;
+  }
+  lock_release(&frame_lock);
+}
+
+/* Drops PAGE's mapping of the frame at KPAGE.  Once no page maps
+   it any longer, removes the frame from the frame table and
+   returns it to the user pool.  The caller must already have
+   cleared PAGE's page table entry. */
+void frame_free(void *kpage, struct page *page)
+{
+  struct frame *f;
+
+  lock_acquire(&frame_lock);
+  f = frame_lookup(kpage);
+  ASSERT(f != NULL);
+  list_remove(&page->frame_elem);
+  if (!list_empty(&f->pages))
+    f = NULL;
+  else
+  {
+    frame_remove(f);
+    palloc_free_page(kpage);
+  }
+  lock_release(&frame_lock);
+
+  free(f);
+}
+
+/* Keeps the frame at KPAGE from being evicted until a matching
+   frame_unpin(). */
+void frame_pin(void *kpage)
+{
+  struct frame *f;
+
+  lock_acquire(&frame_lock);
+  f = frame_lookup(kpage);
+  ASSERT(f != NULL);
+  f->pin_cnt++;
+  lock_release(&frame_lock);
+}
+
+/* Makes the frame at KPAGE a candidate for eviction again, once
+   every process that pinned it has done so. */
+void frame_unpin(void *kpage)
+{
+  struct frame *f;
+
+  lock_acquire(&frame_lock);
+  f = frame_lookup(kpage);
+  ASSERT(f != NULL && f->pin_cnt > 0);
+  f->pin_cnt--;
+  lock_release(&frame_lock);
+}
+
+/* Returns the frame table entry for KPAGE, or a null pointer. */
+static struct frame *
+frame_lookup(void *kpage)
+{
+  struct frame key;
+  struct hash_elem *e;
+
+  key.kpage = kpage;
+  e = hash_find(&frame_map, &key.hash_elem);
+  return e != NULL ? hash_entry(e, struct frame, hash_elem) : NULL;
+}
+
+/* Returns true if P is a page of executable code or read-only
+   data, which every process running the executable can map from
+   the same frame. */
+static bool
+is_shareable(const struct page *p)
+{
+  return p->type == PAGE_FILE && !p->writable;
+}
+
+/* Unlinks F from the frame table, keeping the clock hand valid. */
+static void
+frame_remove(struct frame *f)
+{
+  if (clock_hand == &f->list_elem)
+    clock_hand = list_next(clock_hand);
+  list_remove(&f->list_elem);
+  hash_delete(&frame_map, &f->hash_elem);
+  if (f->inode != NULL)
+    hash_delete(&share_map, &f->share_elem);
+}
+
+/* Removes evicted frame F from the frame table and frees it.
+   Returns KPAGE, or F's kernel address if KPAGE is a null
+   pointer, in which case the frame is kept for reuse instead of
+   going back to the user pool. */
+static void *
+reclaim(struct frame *f, void *kpage)
+{
+  frame_remove(f);
+  if (kpage == NULL)
+    kpage = f->kpage;
+  else
+    palloc_free_page(f->kpage);
+  free(f);
+  return kpage;
+}
+
+/* Returns the frame under the clock hand and moves the hand on,
+   wrapping around at the end of frame_list. */
+static struct frame *
+clock_advance(void)
+{
+  struct frame *f;
+
+  if (clock_hand == NULL || clock_hand == list_end(&frame_list))
+    clock_hand = list_begin(&frame_list);
+  f = list_entry(clock_hand, struct frame, list_elem);
+  clock_hand = list_next(clock_hand);
+  return f;
+}
+
+/* Locks the supplemental page table of OWNER so that it cannot
+   fault a page back in or tear it down under us.  The current
+   thread already holds its own, and may hold OWNER's from an
+   earlier victim of the same eviction pass; other owners are
+   only tried, since they may be waiting for frame_lock.  Sets
+   *RELEASE to whether the caller must unlock it afterward. */
+static bool
+lock_owner(struct thread *owner, bool *release)
+{
+  *release = false;
+  if (owner == thread_current())
+    return lock_held_by_current_thread(&owner->spt_lock);
+  if (lock_held_by_current_thread(&owner->spt_lock))
+    return true;
+  *release = lock_try_acquire(&owner->spt_lock);
+  return *release;
+}
+
+/* Returns true if any page mapped to F was accessed since the
+   clock hand last passed, clearing their accessed bits so that
+   the next pass decides anew. */
+static bool
+frame_accessed(struct frame *f)
+{
+  struct list_elem *e;
+  bool accessed = false;
+
+  for (e = list_begin(&f->pages); e != list_end(&f->pages); e = list_next(e))
+  {
+    struct page *p = list_entry(e, struct page, frame_elem);
+    uint32_t *pd = p->owner->pagedir;
+
+    if (pagedir_is_accessed(pd, p->upage))
+    {
+      pagedir_set_accessed(pd, p->upage, false);
+      accessed = true;
+    }
+  }
+  return accessed;
+}
+
+/* Unmaps shared frame F from every process whose supplemental
+   page table can be locked right now.  Its pages are clean and
+   can be read again from the executable, so nothing is written.
+   Mappings of busy processes are left for a later pass. */
+static void
+unmap_shared(struct frame *f)
+{
+  struct list_elem *e = list_begin(&f->pages);
+
+  while (e != list_end(&f->pages))
+  {
+    struct page *p = list_entry(e, struct page, frame_elem);
+    struct thread *owner = p->owner;
+    bool release;
+
+    e = list_next(e);
+    if (!lock_owner(owner, &release))
+      continue;
+    pagedir_clear_page(owner->pagedir, p->upage);
+    p->kpage = NULL;
+    list_remove(&p->frame_elem);
+    if (release)
+      lock_release(&owner->spt_lock);
+  }
+}
+
+/* Reclaims up to EVICT_CLUSTER frames chosen by the second-chance
+   clock algorithm and returns one of them for reuse; the rest go
+   back to the user pool.  Returns a null pointer if every frame
+   is pinned, busy or recently used and dirty with no swap space.
+   Must be called with frame_lock held, which is released while
+   the victims are written out. */
+static void *
+evict(void)
+{
+  struct frame *victims[EVICT_CLUSTER];
+  struct thread *owners[EVICT_CLUSTER];
+  bool release[EVICT_CLUSTER];
+  bool dirty[EVICT_CLUSTER];
+  bool to_swap[EVICT_CLUSTER];
+  bool evicted[EVICT_CLUSTER];
+  size_t victim_cnt = 0, shared_cnt = 0, swap_cnt = 0;
+  size_t scan_limit = 2 * list_size(&frame_list);
+  size_t first_slot, slot, i;
+  void *kpage = NULL;
+
+  ASSERT(lock_held_by_current_thread(&frame_lock));
+
+  /* Pick victims.  A page that was accessed since the hand last
+     passed gets its accessed bit cleared and a second chance. */
+  while (victim_cnt + shared_cnt < EVICT_CLUSTER && scan_limit-- > 0)
+  {
+    struct frame *f = clock_advance();
+    struct page *p;
+    uint32_t *pd;
+
+    if (f->pin_cnt > 0 || frame_accessed(f))
+      continue;
+
+    /* Shared frames need no I/O and are dropped right away. */
+    if (list_size(&f->pages) > 1)
+    {
+      unmap_shared(f);
+      if (list_empty(&f->pages))
+      {
+        kpage = reclaim(f, kpage);
+        shared_cnt++;
+      }
+      continue;
+    }
+
+    p = list_entry(list_front(&f->pages), struct page, frame_elem);
+    pd = p->owner->pagedir;
+    if (!lock_owner(p->owner, &release[victim_cnt]))
+      continue;
+
+    /* Unmap first: from here on the owner faults and waits on its
+       spt_lock, and the dirty bit can no longer change.  Modified
+       mapped pages go back to their file, other modified pages and
+       pages whose only copy is in memory go to swap. */
+    f->pin_cnt = 1;
+    pagedir_clear_page(pd, p->upage);
+    dirty[victim_cnt] = pagedir_is_dirty(pd, p->upage);
+    to_swap[victim_cnt] = p->type != PAGE_MMAP && (p->type == PAGE_SWAP || dirty[victim_cnt]);
+    if (to_swap[victim_cnt])
+      swap_cnt++;
+
+    /* No other process may start sharing it meanwhile. */
+    if (f->inode != NULL)
+    {
+      hash_delete(&share_map, &f->share_elem);
+      f->inode = NULL;
+    }
+    owners[victim_cnt] = p->owner;
+    victims[victim_cnt++] = f;
+  }
+
+  /* Write the dirty victims out, as one run of consecutive slots
+     when possible and slot by slot otherwise.  This is done
+     without frame_lock, so that page faults and frame allocations
+     elsewhere do not wait for the disk.  The victims stay pinned
+     and their owners' supplemental page tables locked, so nothing
+     else touches them meanwhile. */
+  lock_release(&frame_lock);
+  first_slot = swap_cnt > 0 ? swap_alloc(swap_cnt) : SWAP_ERROR;
+  slot = first_slot;
+  for (i = 0; i < victim_cnt; i++)
+  {
+    struct frame *f = victims[i];
+    struct page *p = list_entry(list_front(&f->pages), struct page, frame_elem);
+
+    evicted[i] = true;
+    if (p->type == PAGE_MMAP && dirty[i])
+      page_write_back(p);
+    else if (to_swap[i])
+    {
+      size_t page_slot = first_slot != SWAP_ERROR ? slot++ : swap_alloc(1);
+      if (page_slot != SWAP_ERROR)
+      {
+        swap_write(page_slot, f->kpage);
+        p->type = PAGE_SWAP;
+        p->swap_slot = page_slot;
+      }
+      else
+      {
+        /* Nowhere to put it: map it back, still dirty. */
+        pagedir_set_page(owners[i]->pagedir, p->upage, f->kpage, p->writable);
+        pagedir_set_dirty(owners[i]->pagedir, p->upage, true);
+        evicted[i] = false;
+      }
+    }
+  }
+  lock_acquire(&frame_lock);
+
+  for (i = 0; i < victim_cnt; i++)
+  {
+    struct frame *f = victims[i];
+    struct page *p = list_entry(list_front(&f->pages), struct page, frame_elem);
+
+    if (evicted[i])
+    {
+      p->kpage = NULL;
+      list_remove(&p->frame_elem);
+      kpage = reclaim(f, kpage);
+    }
+    else
+      f->pin_cnt = 0;
+  }
+
+  /* Owners are unlocked only now, since one of them may own
+     several victims. */
+  for (i = 0; i < victim_cnt; i++)
+    if (release[i])
+      lock_release(&owners[i]->spt_lock);
+
+  return kpage;
+}
+
+/* Hash function for frames. */
+static unsigned
+frame_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry(e, struct frame, hash_elem);
+  return hash_bytes(&f->kpage, sizeof f->kpage);
+}
+
+/* Orders frames by kernel address. */
+static bool
+frame_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  const struct frame *frame_a = hash_entry(a, struct frame, hash_elem);
+  const struct frame *frame_b = hash_entry(b, struct frame, hash_elem);
+
+  return frame_a->kpage < frame_b->kpage;
+}
+
+/* Hash function for shared frames. */
+static unsigned
+share_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct frame *f = hash_entry(e, struct frame, share_elem);
+  return hash_bytes(&f->inode, sizeof f->inode) ^ hash_int(f->offset);
+}
+
+/* Orders shared frames by inode, then by offset. */
+static bool
+share_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  const struct frame *frame_a = hash_entry(a, struct frame, share_elem);
+  const struct frame *frame_b = hash_entry(b, struct frame, share_elem);
+
+  if (frame_a->inode != frame_b->inode)
+    return frame_a->inode < frame_b->inode;
+  return frame_a->offset < frame_b->offset;
+}
@@ -0,0 +1,16 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <stdbool.h>
+
+struct page;
+
+void frame_init(void);
+void *frame_alloc(struct page *page, bool may_evict);
+void *frame_share(struct page *page);
+void frame_publish(void *kpage);
+void frame_free(void *kpage, struct page *page);
+void frame_pin(void *kpage);
+void frame_unpin(void *kpage);
+
+#endif /* vm/frame.h */
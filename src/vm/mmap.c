@@ -0,0 +1,115 @@
+#include "vm/mmap.h"
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+static struct mmap_desc *find_mmap_desc(mapid_t id);
+static void release_mapping(struct mmap_desc *mmap_desc);
+
+/* Maps FILE, which must be a handle private to the mapping, into
+   the current process at page-aligned user address ADDR.  Pages
+   are read on first access.  On success the mapping takes
+   ownership of FILE and its identifier is returned; on failure
+   FILE is closed and MAP_FAILED is returned.
+   Fails if FILE is empty, if ADDR is null or misaligned, or if
+   any page of the range overlaps kernel memory or a page that is
+   already part of the address space. */
+mapid_t mmap_map(struct file *file, void *addr)
+{
+  struct list *mmap_list = &thread_current()->mmap_list;
+  struct mmap_desc *mmap_desc;
+  off_t length = file_length(file);
+  off_t offset;
+
+  if (length == 0 || addr == NULL || pg_ofs(addr) != 0)
+    goto mmap_map_error;
+
+  mmap_desc = malloc(sizeof *mmap_desc);
+  if (mmap_desc == NULL)
+    goto mmap_map_error;
+  mmap_desc->file = file;
+  mmap_desc->addr = addr;
+  mmap_desc->page_cnt = 0;
+
+  for (offset = 0; offset < length; offset += PGSIZE)
+  {
+    uint8_t *upage = (uint8_t *)addr + offset;
+    uint32_t read_bytes = length - offset < PGSIZE ? length - offset : PGSIZE;
+
+    if (!is_user_vaddr(upage) || !page_add_mmap(upage, file, offset, read_bytes))
+    {
+      release_mapping(mmap_desc);
+      return MAP_FAILED;
+    }
+    mmap_desc->page_cnt++;
+  }
+
+  if (list_empty(mmap_list))
+    mmap_desc->id = 1;
+  else
+    mmap_desc->id = list_entry(list_back(mmap_list), struct mmap_desc, elem)->id + 1;
+  list_push_back(mmap_list, &mmap_desc->elem);
+
+  return mmap_desc->id;
+
+mmap_map_error:
+  file_close(file);
+  return MAP_FAILED;
+}
+
+/* Removes mapping ID of the current process, writing modified
+   pages back to the file.  Returns false if there is no such
+   mapping. */
+bool mmap_unmap(mapid_t id)
+{
+  struct mmap_desc *mmap_desc = find_mmap_desc(id);
+
+  if (mmap_desc == NULL)
+    return false;
+
+  list_remove(&mmap_desc->elem);
+  release_mapping(mmap_desc);
+  return true;
+}
+
+/* Removes every mapping of the current process, as at exit. */
+void mmap_unmap_all(void)
+{
+  struct list *mmap_list = &thread_current()->mmap_list;
+
+  while (!list_empty(mmap_list))
+    release_mapping(list_entry(list_pop_front(mmap_list), struct mmap_desc, elem));
+}
+
+/* Returns the current process's mapping with identifier ID, or a
+   null pointer. */
+static struct mmap_desc *
+find_mmap_desc(mapid_t id)
+{
+  struct list *mmap_list = &thread_current()->mmap_list;
+  struct list_elem *e;
+
+  for (e = list_begin(mmap_list); e != list_end(mmap_list); e = list_next(e))
+  {
+    struct mmap_desc *mmap_desc = list_entry(e, struct mmap_desc, elem);
+    if (mmap_desc->id == id)
+      return mmap_desc;
+  }
+  return NULL;
+}
+
+/* Unmaps the pages of MMAP_DESC, which is not on any list, then
+   closes its file and frees it. */
+static void
+release_mapping(struct mmap_desc *mmap_desc)
+{
+  size_t i;
+
+  for (i = 0; i < mmap_desc->page_cnt; i++)
+    page_unmap((uint8_t *)mmap_desc->addr + i * PGSIZE);
+  file_close(mmap_desc->file);
+  free(mmap_desc);
+}
@@ -0,0 +1,24 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+#include <list.h>
+#include <stddef.h>
+
+typedef int mapid_t;
+#define MAP_FAILED ((mapid_t) -1)
+
+/* A memory-mapped file. */
+struct mmap_desc
+{
+  mapid_t id;            /* Mapping identifier. */
+  struct list_elem elem; /* List element for the thread's mappings list. */
+  struct file *file;     /* Private reopened handle on the file. */
+  void *addr;            /* First mapped user page. */
+  size_t page_cnt;       /* Number of mapped pages. */
+};
+
+mapid_t mmap_map(struct file *file, void *addr);
+bool mmap_unmap(mapid_t id);
+void mmap_unmap_all(void);
+
+#endif /* vm/mmap.h */
@@ -0,0 +1,422 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Maximum number of pages a user stack may grow to. */
+size_t stack_page_limit = STACK_PAGE_LIMIT;
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_destructor;
+
+static struct page *page_new(void *upage, enum page_type type, bool writable);
+static struct page *page_create(void *upage, enum page_type type, bool writable);
+static bool page_init_file(struct page *p, struct file *file, off_t file_offset,
+                           uint32_t read_bytes, uint32_t zero_bytes);
+static bool load_page(struct page *p, bool speculative);
+static bool read_file_page(struct page *p, void *kpage);
+static void fault_around(struct hash *spt, const struct page *faulted);
+static bool is_stack_access(const void *uaddr, const void *esp);
+static struct page *lookup_or_grow(const void *uaddr, const void *esp);
+
+/* Initializes supplemental page table SPT.
+   Returns true if successful, false if memory allocation fails. */
+bool page_table_init(struct hash *spt)
+{
+  return hash_init(spt, page_hash, page_less, NULL);
+}
+
+/* Frees every entry of the current process's supplemental page
+   table SPT, along with the frames and swap slots they hold. */
+void page_table_destroy(struct hash *spt)
+{
+  struct thread *current_thread = thread_current();
+
+  lock_acquire(&current_thread->spt_lock);
+  hash_destroy(spt, page_destructor);
+  lock_release(&current_thread->spt_lock);
+}
+
+/* Returns the entry of SPT that covers user address UADDR, or a
+   null pointer if UADDR is not part of the address space. */
+struct page *
+page_lookup(struct hash *spt, const void *uaddr)
+{
+  struct page key;
+  struct hash_elem *e;
+
+  key.upage = pg_round_down(uaddr);
+  e = hash_find(spt, &key.elem);
+  return e != NULL ? hash_entry(e, struct page, elem) : NULL;
+}
+
+/* Adds to the current process's supplemental page table a page
+   at UPAGE whose contents are READ_BYTES bytes of FILE starting
+   at FILE_OFFSET followed by ZERO_BYTES zeros.  Nothing is read
+   until the page is first touched.
+   Returns true if successful, false if UPAGE is already part of
+   the address space or memory allocation fails. */
+bool page_add_file(void *upage, struct file *file, off_t file_offset,
+                   uint32_t read_bytes, uint32_t zero_bytes, bool writable)
+{
+  return page_init_file(page_create(upage, PAGE_FILE, writable),
+                        file, file_offset, read_bytes, zero_bytes);
+}
+
+/* Adds to the current process's supplemental page table a
+   writable page at UPAGE that maps READ_BYTES bytes of FILE
+   starting at FILE_OFFSET.  The rest of the page reads as zeros.
+   Modified contents are written back to FILE when the page is
+   evicted or unmapped; bytes past READ_BYTES never are, so a
+   mapping cannot grow its file.
+   Returns true if successful, false if UPAGE is already part of
+   the address space or memory allocation fails. */
+bool page_add_mmap(void *upage, struct file *file, off_t file_offset,
+                   uint32_t read_bytes)
+{
+  return page_init_file(page_create(upage, PAGE_MMAP, true),
+                        file, file_offset, read_bytes, PGSIZE - read_bytes);
+}
+
+/* Adds to the current process's supplemental page table a page
+   at UPAGE that reads as all zeros until it is written.
+   Returns true if successful, false if UPAGE is already part of
+   the address space or memory allocation fails. */
+bool page_add_zero(void *upage, bool writable)
+{
+  return page_create(upage, PAGE_ZERO, writable) != NULL;
+}
+
+/* Removes UPAGE from the current process's address space,
+   first writing it back to its file if it is a modified
+   PAGE_MMAP page.  Does nothing if UPAGE is not mapped. */
+void page_unmap(void *upage)
+{
+  struct thread *current_thread = thread_current();
+  struct page *p;
+
+  lock_acquire(&current_thread->spt_lock);
+  p = page_lookup(&current_thread->spt, upage);
+  if (p != NULL)
+  {
+    if (p->kpage != NULL && p->type == PAGE_MMAP && pagedir_is_dirty(current_thread->pagedir, p->upage))
+      page_write_back(p);
+    hash_delete(&current_thread->spt, &p->elem);
+    page_destructor(&p->elem, NULL);
+  }
+  lock_release(&current_thread->spt_lock);
+}
+
+/* Writes the resident contents of PAGE_MMAP page P back to its
+   file. */
+void page_write_back(struct page *p)
+{
+  ASSERT(p->type == PAGE_MMAP);
+  ASSERT(p->kpage != NULL);
+
+  file_write_at(p->file, p->kpage, p->read_bytes, p->file_offset);
+}
+
+/* Brings in the page containing FAULT_ADDR for the current
+   process, along with its file-backed neighbours in the same
+   FAULT_AROUND_PAGES window.  ESP is the user stack pointer at the
+   time of the fault; an access just below it, or anywhere between
+   it and the top of the stack, grows the stack by a zeroed page.
+   Returns true if the faulting access can be retried, false if
+   FAULT_ADDR is not part of the address space or the page could
+   not be loaded. */
+bool page_fault_in(const void *fault_addr, const void *esp)
+{
+  struct thread *current_thread = thread_current();
+  struct page *p;
+  bool success;
+
+  if (current_thread->pagedir == NULL || !is_user_vaddr(fault_addr))
+    return false;
+
+  lock_acquire(&current_thread->spt_lock);
+  p = lookup_or_grow(fault_addr, esp);
+  success = p != NULL && p->kpage == NULL && load_page(p, false);
+  if (success && (p->type == PAGE_FILE || p->type == PAGE_MMAP))
+    fault_around(&current_thread->spt, p);
+  lock_release(&current_thread->spt_lock);
+
+  return success;
+}
+
+/* Makes the page containing UADDR resident in the current
+   process and pins its frame, so that the kernel can access it
+   without faulting, as the file system requires.  The stack
+   grows as in page_fault_in().  WRITE requires the page to be
+   writable.  Returns false if UADDR cannot be accessed that way
+   or the page could not be loaded. */
+bool page_pin(const void *uaddr, bool write)
+{
+  struct thread *current_thread = thread_current();
+  struct page *p;
+  bool success;
+
+  if (!is_user_vaddr(uaddr))
+    return false;
+
+  lock_acquire(&current_thread->spt_lock);
+  p = lookup_or_grow(uaddr, current_thread->user_esp);
+  success = p != NULL && (p->writable || !write) && (p->kpage != NULL || load_page(p, false));
+  if (success)
+    frame_pin(p->kpage);
+  lock_release(&current_thread->spt_lock);
+
+  return success;
+}
+
+/* Releases a pin taken on the page containing UADDR by
+   page_pin(). */
+void page_unpin(const void *uaddr)
+{
+  struct thread *current_thread = thread_current();
+  struct page *p;
+
+  lock_acquire(&current_thread->spt_lock);
+  p = page_lookup(&current_thread->spt, uaddr);
+  ASSERT(p != NULL && p->kpage != NULL);
+  frame_unpin(p->kpage);
+  lock_release(&current_thread->spt_lock);
+}
+
+/* Returns the current process's entry for UADDR.  If there is
+   none but UADDR looks like a stack access with the stack pointer
+   at ESP, adds a zeroed page there and returns it.  Returns a
+   null pointer otherwise.  The caller must hold its spt_lock. */
+static struct page *
+lookup_or_grow(const void *uaddr, const void *esp)
+{
+  struct thread *current_thread = thread_current();
+  struct page *p = page_lookup(&current_thread->spt, uaddr);
+
+  if (p == NULL && is_stack_access(uaddr, esp))
+  {
+    p = page_new(pg_round_down(uaddr), PAGE_ZERO, true);
+    if (p != NULL)
+      hash_insert(&current_thread->spt, &p->elem);
+  }
+  return p;
+}
+
+/* Allocates an entry of TYPE for UPAGE in the current process's
+   address space, without inserting it into the supplemental page
+   table.  Returns a null pointer if memory allocation fails. */
+static struct page *
+page_new(void *upage, enum page_type type, bool writable)
+{
+  struct page *p;
+
+  ASSERT(pg_ofs(upage) == 0);
+
+  p = calloc(1, sizeof *p);
+  if (p == NULL)
+    return NULL;
+
+  p->upage = upage;
+  p->kpage = NULL;
+  p->owner = thread_current();
+  p->writable = writable;
+  p->type = type;
+  p->swap_slot = SWAP_ERROR;
+  return p;
+}
+
+/* Allocates an entry of TYPE for UPAGE and inserts it into the
+   current process's supplemental page table.  Returns the new
+   entry, or a null pointer if UPAGE is already present or memory
+   allocation fails. */
+static struct page *
+page_create(void *upage, enum page_type type, bool writable)
+{
+  struct thread *current_thread = thread_current();
+  struct page *p;
+  struct hash_elem *old;
+
+  p = page_new(upage, type, writable);
+  if (p == NULL)
+    return NULL;
+
+  lock_acquire(&current_thread->spt_lock);
+  old = hash_insert(&current_thread->spt, &p->elem);
+  lock_release(&current_thread->spt_lock);
+
+  if (old != NULL)
+  {
+    free(p);
+    return NULL;
+  }
+  return p;
+}
+
+/* Fills in the file-backed fields of new entry P.  Returns false
+   if P is a null pointer, that is, if page_create() failed. */
+static bool
+page_init_file(struct page *p, struct file *file, off_t file_offset,
+               uint32_t read_bytes, uint32_t zero_bytes)
+{
+  ASSERT(read_bytes + zero_bytes == PGSIZE);
+
+  if (p == NULL)
+    return false;
+
+  p->file = file;
+  p->file_offset = file_offset;
+  p->read_bytes = read_bytes;
+  p->zero_bytes = zero_bytes;
+  return true;
+}
+
+/* Obtains a frame for P, fills it from P's backing store and
+   maps it into the current process's page directory.  Read-only
+   executable pages reuse the frame of another process running
+   the same executable when there is one.  A SPECULATIVE load only
+   uses free frames and never evicts.
+   The caller must hold the current thread's spt_lock. */
+static bool
+load_page(struct page *p, bool speculative)
+{
+  struct thread *current_thread = thread_current();
+  uint8_t *kpage;
+  bool success = true;
+
+  ASSERT(lock_held_by_current_thread(&current_thread->spt_lock));
+
+  kpage = frame_share(p);
+  if (kpage != NULL)
+    goto map;
+
+  kpage = frame_alloc(p, !speculative);
+  if (kpage == NULL)
+    return false;
+
+  switch (p->type)
+  {
+  case PAGE_FILE:
+  case PAGE_MMAP:
+    success = read_file_page(p, kpage);
+    if (success)
+      frame_publish(kpage);
+    break;
+  case PAGE_ZERO:
+    memset(kpage, 0, PGSIZE);
+    break;
+  case PAGE_SWAP:
+    swap_read(p->swap_slot, kpage);
+    swap_free(p->swap_slot);
+    p->swap_slot = SWAP_ERROR;
+    break;
+  }
+
+map:
+  if (!success || !pagedir_set_page(current_thread->pagedir, p->upage, kpage, p->writable))
+  {
+    frame_unpin(kpage);
+    frame_free(kpage, p);
+    return false;
+  }
+
+  p->kpage = kpage;
+  frame_unpin(kpage);
+  return true;
+}
+
+/* Reads file-backed page P into KPAGE, zeroing its tail. */
+static bool
+read_file_page(struct page *p, void *kpage)
+{
+  if (p->read_bytes > 0
+      && file_read_at(p->file, kpage, p->read_bytes, p->file_offset) != (off_t)p->read_bytes)
+    return false;
+  memset((uint8_t *)kpage + p->read_bytes, 0, p->zero_bytes);
+  return true;
+}
+
+/* Maps the non-resident pages backed by the same file as FAULTED
+   that lie in FAULTED's aligned FAULT_AROUND_PAGES window, so a
+   sequential sweep over code or data takes one fault per window
+   instead of one per page.  Only free frames are used, and the
+   sweep stops at the first page that cannot be loaded, since
+   none of them were asked for yet. */
+static void
+fault_around(struct hash *spt, const struct page *faulted)
+{
+  uintptr_t window = (uintptr_t)FAULT_AROUND_PAGES * PGSIZE;
+  uint8_t *start = (uint8_t *)((uintptr_t)faulted->upage & ~(window - 1));
+  uint8_t *upage;
+
+  for (upage = start; upage < start + window; upage += PGSIZE)
+  {
+    struct page *p;
+
+    if (upage == faulted->upage || !is_user_vaddr(upage))
+      continue;
+
+    p = page_lookup(spt, upage);
+    if (p == NULL || p->kpage != NULL || p->type != faulted->type || p->file != faulted->file || p->read_bytes == 0)
+      continue;
+
+    if (!load_page(p, true))
+      break;
+  }
+}
+
+/* Returns true if an access to UADDR with the stack pointer at
+   ESP looks like a push or a stack frame reference, and UADDR
+   lies within stack_page_limit pages of the top of user memory. */
+static bool
+is_stack_access(const void *uaddr, const void *esp)
+{
+  const uint8_t *addr = uaddr;
+
+  return addr >= (const uint8_t *)esp - STACK_SLOP
+         && (size_t)((uint8_t *)PHYS_BASE - addr) <= stack_page_limit * PGSIZE;
+}
+
+/* Hash function for supplemental page table entries. */
+static unsigned
+page_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry(e, struct page, elem);
+  return hash_bytes(&p->upage, sizeof p->upage);
+}
+
+/* Orders supplemental page table entries by user address. */
+static bool
+page_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  const struct page *page_a = hash_entry(a, struct page, elem);
+  const struct page *page_b = hash_entry(b, struct page, elem);
+
+  return page_a->upage < page_b->upage;
+}
+
+/* Frees supplemental page table entry E and whatever frame or
+   swap slot it occupies.  The mapping is cleared before the
+   frame is released so that pagedir_destroy() does not free it
+   again; a frame shared with other processes stays theirs. */
+static void
+page_destructor(struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry(e, struct page, elem);
+
+  if (p->kpage != NULL)
+  {
+    pagedir_clear_page(thread_current()->pagedir, p->upage);
+    frame_free(p->kpage, p);
+  }
+  else if (p->type == PAGE_SWAP)
+    swap_free(p->swap_slot);
+  free(p);
+}
@@ -0,0 +1,73 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+/* Number of pages in the aligned window that is mapped around a
+   faulting file-backed page. */
+#define FAULT_AROUND_PAGES 8
+
+/* Default limit on the size of a user stack, in pages (8 MB). */
+#define STACK_PAGE_LIMIT 2048
+
+/* Bytes below the stack pointer that an instruction may touch
+   before it moves the stack pointer down.  PUSHA writes 32 bytes
+   below ESP before decrementing it. */
+#define STACK_SLOP 32
+
+/* Maximum number of pages a user stack may grow to.
+   Set by the -sl kernel command-line option. */
+extern size_t stack_page_limit;
+
+/* Where the contents of a non-resident user page come from. */
+enum page_type
+{
+  PAGE_FILE, /* READ_BYTES from FILE at FILE_OFFSET, rest zeroed. */
+  PAGE_MMAP, /* Like PAGE_FILE, but changes are written back to FILE. */
+  PAGE_ZERO, /* All zeros. */
+  PAGE_SWAP  /* Swap slot SWAP_SLOT. */
+};
+
+/* Supplemental page table entry.
+   Describes one page of a process's user virtual address space,
+   whether or not it currently occupies a frame. */
+struct page
+{
+  void *upage;           /* User virtual address, page aligned. */
+  void *kpage;           /* Kernel address of frame, NULL if not resident. */
+  struct thread *owner;  /* Process whose address space this is. */
+  bool writable;         /* May the user process write to it? */
+  enum page_type type;   /* Backing store type. */
+
+  struct file *file;     /* Backing file for PAGE_FILE and PAGE_MMAP. */
+  off_t file_offset;     /* Offset in FILE of the first byte. */
+  uint32_t read_bytes;   /* Bytes to read from FILE. */
+  uint32_t zero_bytes;   /* Bytes to zero after READ_BYTES. */
+
+  size_t swap_slot;      /* Swap slot for PAGE_SWAP while not resident. */
+
+  struct hash_elem elem;       /* Element in thread's supplemental page table. */
+  struct list_elem frame_elem; /* Element in the frame's list of mappings. */
+};
+
+bool page_table_init(struct hash *spt);
+void page_table_destroy(struct hash *spt);
+
+struct page *page_lookup(struct hash *spt, const void *uaddr);
+bool page_add_file(void *upage, struct file *file, off_t file_offset,
+                   uint32_t read_bytes, uint32_t zero_bytes, bool writable);
+bool page_add_mmap(void *upage, struct file *file, off_t file_offset,
+                   uint32_t read_bytes);
+bool page_add_zero(void *upage, bool writable);
+void page_unmap(void *upage);
+bool page_fault_in(const void *fault_addr, const void *esp);
+bool page_pin(const void *uaddr, bool write);
+void page_unpin(const void *uaddr);
+void page_write_back(struct page *p);
+
+#endif /* vm/page.h */
@@ -0,0 +1,80 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Number of swap device sectors that hold one page. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *swap_device; /* Swap partition, or NULL if none. */
+static struct bitmap *swap_slots; /* One bit per page-sized slot, true if in use. */
+static struct lock swap_lock;     /* Protects swap_slots. */
+
+/* Initializes the swap manager.  Without a swap device every
+   allocation fails, so only clean pages can be evicted. */
+void swap_init(void)
+{
+  lock_init(&swap_lock);
+
+  swap_device = block_get_role(BLOCK_SWAP);
+  if (swap_device == NULL)
+  {
+    printf("swap: no swap device, dirty pages cannot be evicted\n");
+    return;
+  }
+
+  swap_slots = bitmap_create(block_size(swap_device) / SECTORS_PER_SLOT);
+  if (swap_slots == NULL)
+    PANIC("swap: bitmap creation failed--swap device is too large");
+}
+
+/* Reserves CNT consecutive swap slots and returns the first one,
+   or SWAP_ERROR if there is no such run.  Consecutive slots let
+   a cluster of evicted pages go to disk as one sequential
+   write. */
+size_t
+swap_alloc(size_t cnt)
+{
+  size_t slot;
+
+  if (swap_slots == NULL)
+    return SWAP_ERROR;
+
+  lock_acquire(&swap_lock);
+  slot = bitmap_scan_and_flip(swap_slots, 0, cnt, false);
+  lock_release(&swap_lock);
+
+  return slot != BITMAP_ERROR ? slot : SWAP_ERROR;
+}
+
+/* Releases swap slot SLOT. */
+void swap_free(size_t slot)
+{
+  lock_acquire(&swap_lock);
+  ASSERT(bitmap_test(swap_slots, slot));
+  bitmap_reset(swap_slots, slot);
+  lock_release(&swap_lock);
+}
+
+/* Writes the page at KPAGE into swap slot SLOT. */
+void swap_write(size_t slot, const void *kpage)
+{
+  block_sector_t sector = slot * SECTORS_PER_SLOT;
+  size_t i;
+
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    block_write(swap_device, sector + i, (const uint8_t *)kpage + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads swap slot SLOT into the page at KPAGE. */
+void swap_read(size_t slot, void *kpage)
+{
+  block_sector_t sector = slot * SECTORS_PER_SLOT;
+  size_t i;
+
+  for (i = 0; i < SECTORS_PER_SLOT; i++)
+    block_read(swap_device, sector + i, (uint8_t *)kpage + i * BLOCK_SECTOR_SIZE);
+}
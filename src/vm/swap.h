@@ -0,0 +1,16 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returned by swap_alloc() when no slots are available. */
+#define SWAP_ERROR SIZE_MAX
+
+void swap_init(void);
+size_t swap_alloc(size_t cnt);
+void swap_free(size_t slot);
+void swap_write(size_t slot, const void *kpage);
+void swap_read(size_t slot, void *kpage);
+
+#endif /* vm/swap.h */